@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "am.h"
+
+#define AUDIO_FREQ_ADDR      (AUDIO_ADDR + 0x00)
+#define AUDIO_CHANNELS_ADDR  (AUDIO_ADDR + 0x04)
+#define AUDIO_SAMPLES_ADDR   (AUDIO_ADDR + 0x08)
+#define AUDIO_SBUF_SIZE_ADDR (AUDIO_ADDR + 0x0c)
+#define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
+#define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
+#define AUDIO_HEAD_ADDR      (AUDIO_ADDR + 0x18)
+#define AUDIO_COMMIT_ADDR    (AUDIO_ADDR + 0x1c)
+
+static int sbuf_size = 0;
+
+extern volatile uint32_t __am_irqs;
+void __am_irq_wait(AM_IRQ_WAIT_T *wait);
+
+// room opened up, waiters recheck
+void __am_audio_irq() {
+  __am_irqs++;
+}
+
+void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
+  outl(NVIC_ISER, 1u << AUDIO_IRQ);
+}
+
+void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
+}
+
+void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
+}
+
+void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
+  stat->count = inl(AUDIO_COUNT_ADDR);
+}
+
+// the stream buffer is plain memory: copy behind the head, then one commit
+// for the whole piece, sleeping until the next period while the buffer is full
+void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *sbuf = (uint8_t *)AUDIO_SBUF_ADDR;
+  uint8_t *src = ctl->buf.start;
+  int len = (uint8_t *)ctl->buf.end - src;
+
+  while (len > 0) {
+    AM_IRQ_WAIT_T wait = { .seen = __am_irqs };
+    int room = sbuf_size - (int)inl(AUDIO_COUNT_ADDR);
+    if (room <= 0) {
+      __am_irq_wait(&wait);
+      continue;
+    }
+
+    int n = len < room ? len : room;
+    int head = inl(AUDIO_HEAD_ADDR);
+    int first = n < sbuf_size - head ? n : sbuf_size - head;
+    memcpy(sbuf + head, src, first);
+    memcpy(sbuf, src + first, n - first);
+    outl(AUDIO_COMMIT_ADDR, n);
+    src += n;
+    len -= n;
+  }
+}
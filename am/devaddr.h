@@ -13,4 +13,27 @@
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
 
+// private peripheral bus, clocked by the core
+#define DWT_ADDR        0xe0001000
+#define DWT_CTRL        (DWT_ADDR + 0x0)
+#define DWT_CYCCNT      (DWT_ADDR + 0x4)
+#define SYSTICK_ADDR    0xe000e010
+#define SYST_CSR        (SYSTICK_ADDR + 0x0)
+#define SYST_RVR        (SYSTICK_ADDR + 0x4)
+#define SYST_CVR        (SYSTICK_ADDR + 0x8)
+#define SYST_CALIB      (SYSTICK_ADDR + 0xc)
+#define NVIC_ADDR       0xe000e100
+#define NVIC_ISER       (NVIC_ADDR + 0x000)
+#define NVIC_ICER       (NVIC_ADDR + 0x080)
+#define NVIC_ISPR       (NVIC_ADDR + 0x100)
+#define NVIC_ICPR       (NVIC_ADDR + 0x180)
+#define NVIC_IPR(n)     (NVIC_ADDR + 0x300 + (n))
+#define SCB_ICSR        (NVIC_ADDR + 0xc04)
+#define SCB_SHPR2       (NVIC_ADDR + 0xc1c)
+#define SCB_SHPR3       (NVIC_ADDR + 0xc20)
+
+// nvic irq lines
+#define KBD_IRQ         0
+#define AUDIO_IRQ       1
+
 #endif
\ No newline at end of file
@@ -1,10 +1,52 @@
 #include "am.h"
+#include "../boot/def.h"
 
 #define KEYDOWN_MASK 0x8000
 #define KEYCODE_MASK 0x7FFF
 
+#define KEYQ_LEN 64
+
+extern volatile uint32_t __am_irqs;
+
+// keys the interrupt took off the device, head - tail of them waiting
+static volatile uint32_t keyq[KEYQ_LEN];
+static volatile uint32_t head = 0, tail = 0;
+static volatile bool stopped = false;
+
+// the device keeps its line up while it holds a key, so with the queue full
+// the irq stays off until a read makes room
+static void drain() {
+  while (head - tail < KEYQ_LEN) {
+    uint32_t kbdreg = inl(KBD_ADDR);
+    if (!kbdreg) return;
+    keyq[head % KEYQ_LEN] = kbdreg;
+    head++;
+  }
+  outl(NVIC_ICER, 1u << KBD_IRQ);
+  stopped = true;
+}
+
+void __am_input_irq() {
+  drain();
+  __am_irqs++;
+}
+
+void __am_input_init() {
+  outl(NVIC_ISER, 1u << KBD_IRQ);
+}
+
 void __am_input_keybrd(AM_INPUT_KEYBRD_T *kbd) {
-  unsigned kbdreg = inl(KBD_ADDR);
+  unsigned kbdreg = 0;
+  cpsid();
+  if (head != tail) {
+    kbdreg = keyq[tail % KEYQ_LEN];
+    tail++;
+  }
+  if (stopped) {
+    stopped = false;
+    outl(NVIC_ISER, 1u << KBD_IRQ);
+  }
+  cpsie();
   kbd->keycode = kbdreg & KEYCODE_MASK;
   kbd->keydown = kbdreg & KEYDOWN_MASK;
 }
@@ -0,0 +1,25 @@
+#include "am.h"
+#include "../boot/def.h"
+
+// bumped by every device interrupt, a waiter only sleeps while it has not
+// moved since the waiter last looked
+volatile uint32_t __am_irqs = 0;
+
+// the kernel runs system calls in svc, which drops below the devices so
+// their interrupts still come through
+void __am_irq_init() {
+  outl(SCB_SHPR2, 0x80u << 24);
+}
+
+// masked from the check to wfi, an interrupt arriving in between stays
+// pending and wakes wfi right away
+void __am_irq_wait(AM_IRQ_WAIT_T *wait) {
+  cpsid();
+  if (__am_irqs == wait->seen)
+    wfi();
+  cpsie();
+}
+
+void __am_irq_count(AM_IRQ_COUNT_T *cnt) {
+  cnt->count = __am_irqs;
+}
@@ -2,12 +2,19 @@
 
 static uint64_t start = 0;
 
+// the low word latches the high one, so read it first
+static uint64_t rtc_read() {
+  uint32_t lo = inl(RTC_ADDR);
+  uint32_t hi = inl(RTC_ADDR + 4);
+  return (uint64_t)hi << 32 | lo;
+}
+
 void __am_timer_init() {
-  start = (unsigned long)inl(RTC_ADDR);
+  start = rtc_read();
 }
 
 void __am_timer_uptime(AM_TIMER_UPTIME_T *uptime) {
-  uptime->us = (unsigned long)inl(RTC_ADDR) - start;
+  uptime->us = rtc_read() - start;
 }
 
 void __am_timer_rtc(AM_TIMER_RTC_T *rtc) {
@@ -1,16 +1,38 @@
 #include "def.h"
+#include "../am/devaddr.h"
 
 #define STACK_BASE 0x20020000
 #define STACK_SIZE 0x8000
 #define HEAP_BASE 0x20020000
 #define HEAP_SIZE 0x10000 - STACK_SIZE
 
-enum { MSP = 0, RST = 1, NMI = 2, HARDWARE_ERROR = 3, SVC = 11 };
+enum { MSP = 0, RST = 1, NMI = 2, HARDWARE_ERROR = 3, SVC = 11, PENDSV = 14, SYSTICK = 15, IRQ0 = 16 };
+
+// svc is an exception: the caller's r0-r3 come from the frame stacked on
+// entry and the result has to go back there, as exception return unstacks r0
+__attribute__((naked)) static void svc_handler(void) {
+  asm volatile(
+    "movs r0, #4\n"
+    "mov r1, lr\n"
+    "tst r0, r1\n"
+    "beq 1f\n"
+    "mrs r0, psp\n"
+    "b 2f\n"
+    "1: mrs r0, msp\n"
+    "2: push {r0, lr}\n"
+    "ldm r0, {r0-r3}\n"
+    "bl do_syscall\n"
+    "pop {r1, r2}\n"
+    "str r0, [r1]\n"
+    "bx r2\n");
+}
 
 const uintptr_t interrupt_descriptor_table[] __attribute__((section(".interp"))) = {
   [MSP] = (uintptr_t)STACK_BASE,
   [RST] = (uintptr_t)_start,
-  [SVC] = (uintptr_t)do_syscall,
+  [SVC] = (uintptr_t)svc_handler,
+  [IRQ0 + KBD_IRQ] = (uintptr_t)__am_input_irq,
+  [IRQ0 + AUDIO_IRQ] = (uintptr_t)__am_audio_irq,
 };
 
 // volatile char endofbin[0] __attribute__((aligned(4), section(".eob")));
@@ -12,18 +12,25 @@
 #ifndef DEF_H__
 #define DEF_H__
 
-// arm asm for Cortex M0
-static inline void wfe() { asm volatile("wfe"); }
-static inline void wfi() { asm volatile("wfi"); }
-static inline void cpsid() { asm volatile("cpsid i"); }
-static inline void cpsie() { asm volatile("cpsie i"); }
+// arm asm for Cortex M0, the memory clobbers keep the compiler from moving
+// loads and stores across a sleep, a barrier or a change of the irq mask
+static inline void wfe() { asm volatile("wfe" ::: "memory"); }
+static inline void wfi() { asm volatile("wfi" ::: "memory"); }
+static inline void cpsid() { asm volatile("cpsid i" ::: "memory"); }
+static inline void cpsie() { asm volatile("cpsie i" ::: "memory"); }
 static inline void sev() { asm volatile("sev"); }
 static inline void nop() { asm volatile("nop"); }
-static inline void dmb() { asm volatile("dmb"); }
-static inline void dsb() { asm volatile("dsb"); }
-static inline void isb() { asm volatile("isb"); }
+static inline void dmb() { asm volatile("dmb" ::: "memory"); }
+static inline void dsb() { asm volatile("dsb" ::: "memory"); }
+static inline void isb() { asm volatile("isb" ::: "memory"); }
 static inline void yield() { asm volatile("yield"); }
 
+// yield stops the simulator, which reports r0 as the exit status
+static inline void halt(uintptr_t code) {
+  register uintptr_t r0 asm("r0") = code;
+  asm volatile("yield" : : "r"(r0));
+}
+
 #define svc(code) asm volatile ("svc %[immediate]"::[immediate] "I" (code))
 
 #define bkpt(code) asm volatile ("bkpt %[immediate]"::[immediate] "I" (code))
@@ -32,6 +39,10 @@ static inline void yield() { asm volatile("yield"); }
 void _start(void);
 int main(void);
 
+// device interrupts, handled in am
+void __am_input_irq(void);
+void __am_audio_irq(void);
+
 //
 // misc
 //
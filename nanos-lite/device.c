@@ -8,7 +8,34 @@ size_t serial_write(const void *buf, size_t offset, size_t len) {
   return 0;
 }
 
+#define NAME(key) [AM_KEY_##key] = #key,
+static const char *keyname[] = {
+  [AM_KEY_NONE] = "NONE",
+  AM_KEYS(NAME)
+};
+
+// one event per read as "kd NAME" or "ku NAME", which is what libminiSDL's
+// read_keyinfo compares, 0 when no key is waiting
 size_t events_read(void *buf, size_t offset, size_t len) {
+  AM_INPUT_KEYBRD_T ev = io_read(AM_INPUT_KEYBRD);
+  if (ev.keycode == AM_KEY_NONE) {
+    return 0;
+  }
+
+  int ret = snprintf(buf, len, "k%c %s", ev.keydown ? 'd' : 'u', keyname[ev.keycode]);
+  if (ret >= len) {
+    assert(0);
+  }
+
+  return ret + 1;
+}
+
+// sleeps until a device interrupt came in after the previous wait returned,
+// then a key or room for audio may be there, nothing is read
+size_t wait_read(void *buf, size_t offset, size_t len) {
+  static uint32_t seen = 0;
+  io_write(AM_IRQ_WAIT, seen);
+  seen = io_read(AM_IRQ_COUNT).count;
   return 0;
 }
 
@@ -31,7 +58,13 @@ size_t dispinfo_read(void *buf, size_t offset, size_t len) {
 size_t fb_write(const void *buf, size_t offset, size_t len) {
   const char *src = (const char *)buf;
   char *fb = (char *)(uintptr_t)(FB_ADDR + offset);
-  for (int i = 0; i < len; ++i){
+  size_t i = 0;
+  // whole pixels when both sides are aligned, every store is a device access
+  if ((((uintptr_t)src | (uintptr_t)fb) & 3) == 0) {
+    for (; i + 4 <= len; i += 4)
+      *(uint32_t *)(fb + i) = *(const uint32_t *)(src + i);
+  }
+  for (; i < len; ++i){
     fb[i] = src[i];
   }
   
@@ -41,6 +74,28 @@ size_t fb_write(const void *buf, size_t offset, size_t len) {
   return len;
 }
 
+// 3 ints written, freq, channels and samples, (re)open the stream, a read
+// gives the free bytes of the stream buffer as an int
+size_t sbctl_write(const void *buf, size_t offset, size_t len) {
+  assert(len >= 3 * sizeof(int));
+  const int *arg = buf;
+  io_write(AM_AUDIO_CTRL, arg[0], arg[1], arg[2]);
+  return len;
+}
+
+size_t sbctl_read(void *buf, size_t offset, size_t len) {
+  assert(len >= sizeof(int));
+  int room = io_read(AM_AUDIO_CONFIG).bufsize - io_read(AM_AUDIO_STATUS).count;
+  memcpy(buf, &room, sizeof(room));
+  return sizeof(room);
+}
+
+// returns once everything is in the stream buffer
+size_t sb_write(const void *buf, size_t offset, size_t len) {
+  io_write(AM_AUDIO_PLAY, .buf = { .start = (void *)buf, .end = (char *)buf + len });
+  return len;
+}
+
 void init_device() {
   ioe_init();
 }
@@ -19,10 +19,14 @@ size_t serial_write(const void *buf, size_t offset, size_t len);
 size_t events_read(void *buf, size_t offset, size_t len);
 size_t dispinfo_read(void *buf, size_t offset, size_t len);
 size_t fb_write(const void *buf, size_t offset, size_t len);
+size_t sb_write(const void *buf, size_t offset, size_t len);
+size_t sbctl_read(void *buf, size_t offset, size_t len);
+size_t sbctl_write(const void *buf, size_t offset, size_t len);
+size_t wait_read(void *buf, size_t offset, size_t len);
 
 static size_t disk_sz = 0;
 
-enum {FD_STDIN, FD_STDOUT, FD_STDERR, FD_FB, FD_EVENTS, FD_DISPINFO, FD_END};
+enum {FD_STDIN, FD_STDOUT, FD_STDERR, FD_FB, FD_EVENTS, FD_DISPINFO, FD_SB, FD_SBCTL, FD_WAIT, FD_END};
 
 size_t invalid_read(void *buf, size_t offset, size_t len) {
   return 0;
@@ -48,6 +52,9 @@ static Finfo file_table[] __attribute__((used)) = {
   [FD_FB]       = {"/dev/fb",         0, 0, invalid_read,   fb_write      },
   [FD_EVENTS]   = {"/dev/events",     0, 0, events_read,    invalid_write },
   [FD_DISPINFO] = {"/proc/dispinfo",  0, 0, dispinfo_read,  invalid_write },
+  [FD_SB]       = {"/dev/sb",         0, 0, invalid_read,   sb_write      },
+  [FD_SBCTL]    = {"/dev/sbctl",      0, 0, sbctl_read,     sbctl_write   },
+  [FD_WAIT]     = {"/dev/wait",       0, 0, wait_read,      invalid_write },
 #include "files.h"
 };
 
@@ -9,7 +9,7 @@
 uintptr_t do_syscall(uintptr_t r0, uintptr_t r1, uintptr_t r2, uintptr_t r3) {
   switch (r0) {
     case SYS_yield: yield();                                break;
-    case SYS_exit:  nop();                                break;
+    case SYS_exit:  halt(r1);                             break;
     case SYS_open:  return fs_open ((char *)r1, r2, r3);  break;
     case SYS_write: return fs_write(r1, (void *)r2, r3);  break;
     case SYS_brk:                                         break;
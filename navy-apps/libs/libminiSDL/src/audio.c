@@ -1,17 +1,60 @@
 #include <NDL.h>
 #include <SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+// there is no audio thread, the callback runs from SDL_PollEvent, SDL_WaitEvent
+// and SDL_Delay whenever a whole period fits in the stream buffer
+static SDL_AudioSpec spec;
+static uint8_t *stream = NULL;
+static int opened = 0, paused = 1, pumping = 0;
+
+void __SDL_PumpAudio() {
+  if (!opened || paused || pumping) return;
+  pumping = 1;
+  while (NDL_QueryAudio() >= (int)spec.size) {
+    memset(stream, 0, spec.size);
+    spec.callback(spec.userdata, stream, spec.size);
+    NDL_PlayAudio(stream, spec.size);
+  }
+  pumping = 0;
+}
 
 int SDL_OpenAudio(SDL_AudioSpec *desired, SDL_AudioSpec *obtained) {
+  if (opened || desired->format != AUDIO_S16SYS || !desired->callback) return -1;
+  spec = *desired;
+  spec.size = spec.samples * spec.channels * sizeof(int16_t);
+  stream = malloc(spec.size);
+  if (!stream) return -1;
+  if (obtained) *obtained = spec;
+  NDL_OpenAudio(spec.freq, spec.channels, spec.samples);
+  opened = 1;
+  paused = 1;
   return 0;
 }
 
 void SDL_CloseAudio() {
+  if (!opened) return;
+  NDL_CloseAudio();
+  free(stream);
+  stream = NULL;
+  opened = 0;
 }
 
 void SDL_PauseAudio(int pause_on) {
+  paused = pause_on;
+  __SDL_PumpAudio();
 }
 
 void SDL_MixAudio(uint8_t *dst, uint8_t *src, uint32_t len, int volume) {
+  int16_t *d = (int16_t *)dst, *s = (int16_t *)src;
+  if (volume > SDL_MIX_MAXVOLUME) volume = SDL_MIX_MAXVOLUME;
+  for (uint32_t i = 0; i < len / 2; i++) {
+    int v = d[i] + s[i] * volume / SDL_MIX_MAXVOLUME;
+    if (v > INT16_MAX) v = INT16_MAX;
+    if (v < INT16_MIN) v = INT16_MIN;
+    d[i] = v;
+  }
 }
 
 SDL_AudioSpec *SDL_LoadWAV(const char *file, SDL_AudioSpec *spec, uint8_t **audio_buf, uint32_t *audio_len) {
@@ -21,6 +64,7 @@ SDL_AudioSpec *SDL_LoadWAV(const char *file, SDL_AudioSpec *spec, uint8_t **audi
 void SDL_FreeWAV(uint8_t *audio_buf) {
 }
 
+// the callback only runs from the pump, it can not race the caller
 void SDL_LockAudio() {
 }
 
@@ -15,6 +15,8 @@ static event_element event_queue = {.type = 0, .sym = 0, .next = NULL};
 
 static event_element *end = &event_queue;
 
+void __SDL_PumpAudio();
+
 static void append(uint8_t type, uint8_t sym) {
   event_element *new_element = (event_element *)malloc(sizeof(event_element));
   new_element->type = type;
@@ -73,6 +75,7 @@ int SDL_PushEvent(SDL_Event *ev) {
 
 int SDL_PollEvent(SDL_Event *ev) {
   uint8_t type = 0, sym = 0;
+  __SDL_PumpAudio();
   if (read_keyinfo(&type, &sym)) {
     ev->type = type;
     ev->key.keysym.sym = sym;
@@ -87,7 +90,10 @@ int SDL_PollEvent(SDL_Event *ev) {
 
 int SDL_WaitEvent(SDL_Event *event) {
   uint8_t type = 0, sym = 0;
-  while (!read_keyinfo(&type, &sym));
+  while (!read_keyinfo(&type, &sym)) {
+    __SDL_PumpAudio();
+    NDL_Wait();
+  }
   event->type = type;
   event->key.keysym.sym = sym;
   switch(type){
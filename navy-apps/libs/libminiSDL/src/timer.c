@@ -2,6 +2,8 @@
 #include <sdl-timer.h>
 #include <stdio.h>
 
+void __SDL_PumpAudio();
+
 SDL_TimerID SDL_AddTimer(uint32_t interval, SDL_NewTimerCallback callback, void *param) {
   return NULL;
 }
@@ -16,5 +18,5 @@ uint32_t SDL_GetTicks() {
 
 void SDL_Delay(uint32_t ms) {
   uint32_t start = NDL_GetTicks();
-  while(NDL_GetTicks() - start <= ms);
+  while(NDL_GetTicks() - start <= ms) __SDL_PumpAudio();
 }
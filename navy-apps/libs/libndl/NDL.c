@@ -26,6 +26,15 @@ int NDL_PollEvent(char *buf, int len) {
   return !!cnt;
 }
 
+// returns after a device interrupt, at once if one came in since the last
+// call returned, so whatever was checked before it is worth checking again
+void NDL_Wait() {
+  static int waitdev = -1;
+  char c;
+  if (waitdev < 0) waitdev = open("/dev/wait", O_RDONLY);
+  read(waitdev, &c, sizeof(c));
+}
+
 #define W 400
 #define H 300
 #define CSIZE W * H * 4
@@ -57,18 +66,33 @@ void NDL_DrawRect(uint32_t *pixels, int x, int y, int w, int h) {
   }
 }
 
+static int sbdev = -1, sbctl = -1;
+
 void NDL_OpenAudio(int freq, int channels, int samples) {
+  if (sbctl < 0) {
+    sbctl = open("/dev/sbctl", O_RDWR);
+    sbdev = open("/dev/sb", O_WRONLY);
+  }
+  int arg[3] = {freq, channels, samples};
+  write(sbctl, arg, sizeof(arg));
 }
 
 void NDL_CloseAudio() {
+  close(sbdev);
+  close(sbctl);
+  sbdev = sbctl = -1;
 }
 
+// blocks until all of @buf is queued
 int NDL_PlayAudio(void *buf, int len) {
-  return 0;
+  return write(sbdev, buf, len);
 }
 
+// free bytes in the stream buffer
 int NDL_QueryAudio() {
-  return 0;
+  int room = 0;
+  read(sbctl, &room, sizeof(room));
+  return room;
 }
 
 int NDL_Init(uint32_t flags) {
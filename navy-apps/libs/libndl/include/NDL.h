@@ -12,6 +12,7 @@ void NDL_Quit();
 uint32_t NDL_GetTicks();
 void NDL_OpenCanvas(int *w, int *h);
 int NDL_PollEvent(char *buf, int len);
+void NDL_Wait();
 void NDL_DrawRect(uint32_t *pixels, int x, int y, int w, int h);
 void NDL_OpenAudio(int freq, int channels, int samples);
 void NDL_CloseAudio();
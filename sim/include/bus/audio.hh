@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device.hh"
+
+class Nvic;
+
+#define AUDIO_FREQ 0x00
+#define AUDIO_CHANNELS 0x04
+#define AUDIO_SAMPLES 0x08 // frames per period
+#define AUDIO_SBUF_SIZE 0x0c
+#define AUDIO_INIT 0x10
+#define AUDIO_COUNT 0x14  // bytes committed and not played yet
+#define AUDIO_HEAD 0x18   // offset in the stream buffer of the next commit
+#define AUDIO_COMMIT 0x1c // write n: the n bytes from head on are ready
+
+#define AUDIO_SBUF_BYTES 0x10000
+#define AUDIO_WAV_RING (1 << 20) // bytes between the core and the writer
+
+// A WAV file of 16-bit pcm, fed through a ring and written by a thread. The
+// header takes the last format set and its sizes are fixed up on close.
+class WavWriter {
+  FILE *fp;
+  uint32_t freq = 0, channels = 0;
+  uint64_t written = 0;
+
+  std::vector<char> ring;
+  size_t head = 0; // free running, head - tail bytes are waiting
+  size_t tail = 0;
+  std::mutex lock;
+  std::condition_variable ready; // to the writer
+  std::condition_variable freed; // from the writer
+  bool done = false;
+  std::thread writer;
+
+  void drain();
+
+public:
+  WavWriter(const char *path);
+  ~WavWriter();
+
+  void format(uint32_t freq, uint32_t channels);
+  // waits while the ring is full, nothing is dropped
+  void push(const char *buf, size_t len);
+};
+
+// A stream of 16-bit little endian pcm. The guest copies samples into the
+// stream buffer, which is plain memory, behind HEAD and commits them with a
+// single register write, so there is no trap per sample. Playback is paced by
+// the core's cycles a period at a time, that keeps COUNT deterministic and
+// lets idle skip wait for room. Played samples go to @wav, or nowhere. The irq
+// pulses at every period boundary that freed room.
+class Audio : public RegisterDevice {
+  CycleSource cycles;
+  Nvic *nvic;
+  uint32_t irq;
+  const char *sbuf;
+  WavWriter *wav;
+
+  uint32_t freq = 0, channels = 0, samples = 0;
+  bool running = false;
+  uint64_t head = 0; // free running, committed up to
+  uint64_t tail = 0; // played up to
+  uint64_t base = 0; // cycle count at the last period boundary
+  uint64_t pcycles = 0; // cycles per period
+  uint32_t pbytes = 0;  // bytes per period
+  bool freed = false;   // played something since the last poll
+
+  // plays every period that has passed since base
+  void play();
+  void emit(uint64_t len);
+
+public:
+  // @nvic takes irq @irq, if there is one
+  Audio(CycleSource cycles, Nvic *nvic, uint32_t irq, Device *sbuf,
+        WavWriter *wav = nullptr);
+  ~Audio();
+
+  uint64_t next_event(uint64_t now) override;
+
+  // pends the irq once room opened up
+  void poll() override;
+  // the next period boundary that frees room
+  uint64_t deadline() override;
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
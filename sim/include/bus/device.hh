@@ -1,7 +1,36 @@
 #pragma once
 
+#include <bit>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+
+// guest memory is little endian whatever the host is
+template <typename T> inline T load_le(const char *p) {
+  T val;
+  memcpy(&val, p, sizeof(val));
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 8)
+    val = __builtin_bswap64(val);
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 4)
+    val = __builtin_bswap32(val);
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 2)
+    val = __builtin_bswap16(val);
+  return val;
+}
+
+template <typename T> inline void store_le(char *p, T val) {
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 8)
+    val = __builtin_bswap64(val);
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 4)
+    val = __builtin_bswap32(val);
+  if constexpr (std::endian::native == std::endian::big && sizeof(T) == 2)
+    val = __builtin_bswap16(val);
+  memcpy(p, &val, sizeof(val));
+}
+
+// the core's cycle count, for devices that keep time in guest cycles
+using CycleSource = std::function<uint64_t()>;
 
 class Device {
 protected:
@@ -12,20 +41,67 @@ public:
 
   const size_t &size();
 
+  // host memory backing the whole device for plain loads (@write false) or
+  // stores (@write true), nullptr if the access has to go through the device
+  virtual char *direct(bool write);
+
+  // the cycle count at which the device next changes on its own, for
+  // skipping idle time, ~0 if it never does
+  virtual uint64_t next_event(uint64_t now) { return ~0ull; }
+  // the core slept on the host, devices following the host clock catch up
+  virtual void resync() {}
+
+  // interrupt sources attached to the nvic pend what is due there when
+  // polled, between blocks and before wfi sleeps
+  virtual void poll() {}
+  // the cycle count at which poll next has something to pend, ~0 if never
+  virtual uint64_t deadline() { return ~0ull; }
+
   virtual void write(char *buf, size_t addr, size_t len) = 0;
   virtual void read(char *buf, size_t addr, size_t len) = 0;
 
-  virtual void write64(uint64_t &dword, size_t addr) = 0;
-  virtual void read64(uint64_t &dword, size_t addr) = 0;
+  // typed accessors through write / read, for devices without a faster way
+  template <typename T> void store(T val, size_t addr) {
+    char buf[sizeof(T)];
+    store_le(buf, val);
+    write(buf, addr, sizeof(T));
+  }
 
-  virtual void write32(uint32_t &word, size_t addr) = 0;
-  virtual void read32(uint32_t &word, size_t addr) = 0;
+  template <typename T> T fetch(size_t addr) {
+    char buf[sizeof(T)] = {};
+    read(buf, addr, sizeof(T));
+    return load_le<T>(buf);
+  }
 
-  virtual void write16(uint16_t &hword, size_t addr) = 0;
-  virtual void read16(uint16_t &hword, size_t addr) = 0;
+  virtual void write64(uint64_t &dword, size_t addr) { store(dword, addr); }
+  virtual void read64(uint64_t &dword, size_t addr) {
+    dword = fetch<uint64_t>(addr);
+  }
 
-  virtual void write8(uint8_t &byte, size_t addr) = 0;
-  virtual void read8(uint8_t &byte, size_t addr) = 0;
+  virtual void write32(uint32_t &word, size_t addr) { store(word, addr); }
+  virtual void read32(uint32_t &word, size_t addr) {
+    word = fetch<uint32_t>(addr);
+  }
+
+  virtual void write16(uint16_t &hword, size_t addr) { store(hword, addr); }
+  virtual void read16(uint16_t &hword, size_t addr) {
+    hword = fetch<uint16_t>(addr);
+  }
+
+  virtual void write8(uint8_t &byte, size_t addr) { store(byte, addr); }
+  virtual void read8(uint8_t &byte, size_t addr) {
+    byte = fetch<uint8_t>(addr);
+  }
 
   virtual ~Device() = default;
-};
\ No newline at end of file
+};
+
+// A bank of word registers, narrower loads read the word through read32 and
+// narrower stores fault, so subclasses only implement read32 / write32
+class RegisterDevice : public Device {
+public:
+  using Device::Device;
+
+  void write(char *buf, size_t addr, size_t len) override;
+  void read(char *buf, size_t addr, size_t len) override;
+};
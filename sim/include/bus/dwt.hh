@@ -0,0 +1,25 @@
+#pragma once
+
+#include "device.hh"
+
+#define DWT_CTRL 0x0
+#define DWT_CYCCNT 0x4
+
+#define DWT_CTRL_CYCCNTENA (1u << 0)
+
+// The cycle counter of an ARMv7-M style data watchpoint unit, ARMv6-M has
+// none but guests find it where they expect it. No comparators.
+class Dwt : public RegisterDevice {
+  CycleSource cycles;
+  uint32_t ctrl = 0;
+  uint32_t cyccnt = 0; // value at base, or the frozen value when disabled
+  uint64_t base = 0;
+
+  uint32_t count();
+
+public:
+  Dwt(CycleSource cycles);
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
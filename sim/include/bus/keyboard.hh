@@ -0,0 +1,64 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "device.hh"
+
+class Nvic;
+
+#define KBD_DATA 0x0
+
+#define KBD_KEYDOWN_MASK 0x8000
+#define KBD_KEYCODE_MASK 0x7fff
+
+// the key codes of am.h, AM_KEY_NONE is 0 and the rest count up from 1
+#define KBD_KEYS(_)                                                            \
+  _(ESCAPE) _(F1) _(F2) _(F3) _(F4) _(F5) _(F6) _(F7) _(F8) _(F9) _(F10)       \
+  _(F11) _(F12) _(GRAVE) _(1) _(2) _(3) _(4) _(5) _(6) _(7) _(8) _(9) _(0)     \
+  _(MINUS) _(EQUALS) _(BACKSPACE) _(TAB) _(Q) _(W) _(E) _(R) _(T) _(Y) _(U)    \
+  _(I) _(O) _(P) _(LEFTBRACKET) _(RIGHTBRACKET) _(BACKSLASH) _(CAPSLOCK) _(A)  \
+  _(S) _(D) _(F) _(G) _(H) _(J) _(K) _(L) _(SEMICOLON) _(APOSTROPHE)           \
+  _(RETURN) _(LSHIFT) _(Z) _(X) _(C) _(V) _(B) _(N) _(M) _(COMMA) _(PERIOD)    \
+  _(SLASH) _(RSHIFT) _(LCTRL) _(APPLICATION) _(LALT) _(SPACE) _(RALT)          \
+  _(RCTRL) _(UP) _(DOWN) _(LEFT) _(RIGHT) _(INSERT) _(DELETE) _(HOME) _(END)   \
+  _(PAGEUP) _(PAGEDOWN)
+
+struct KeyEvent {
+  uint64_t at; // core cycle from which the guest can read it
+  uint16_t code;
+  bool down;
+};
+
+// Key events replayed from a script. An event queues once the core's cycle
+// count reaches its stamp, and every read of the data register takes the
+// oldest queued one, 0 when there is none. Cycles are deterministic, so the
+// same image and script see the same input at the same instruction. The irq
+// line is up while the queue is not empty.
+class Keyboard : public RegisterDevice {
+  CycleSource cycles;
+  Nvic *nvic;
+  uint32_t irq;
+  std::deque<KeyEvent> script;
+
+public:
+  // @nvic takes irq @irq, if there is one
+  Keyboard(CycleSource cycles, Nvic *nvic, uint32_t irq,
+           std::vector<KeyEvent> script = {});
+
+  // script lines are "cycle key d|u", the key by its am.h name without
+  // AM_KEY_ or as a number, # starts a comment. On failure @err says why.
+  static bool parse(const char *path, std::vector<KeyEvent> &events,
+                    std::string &err);
+
+  uint64_t next_event(uint64_t now) override;
+
+  // pends the irq while a key is queued
+  void poll() override;
+  // the stamp of the next key to queue
+  uint64_t deadline() override;
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
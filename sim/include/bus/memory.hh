@@ -2,30 +2,67 @@
 
 #include "device.hh"
 
-class Memory : public Device {
+class Memory final : public Device {
   char *data;
+  // file mapped at the start of data by load(), -1 if none
+  int fd = -1;
+  size_t filesiz = 0;
   bool wen;
   bool ren;
   bool xen;
+
+  // host address of a @T at @addr, the only check on the typed paths
+  template <typename T> char *at(size_t addr, bool allowed) {
+    if (!allowed)
+      permission_denied();
+    if (addr > devsiz - sizeof(T))
+      out_of_range();
+    return data + addr;
+  }
+
+  [[noreturn]] static void permission_denied();
+  [[noreturn]] static void out_of_range();
+
 public:
   Memory(size_t siz, bool w = true, bool r = true, bool x = true);
   ~Memory();
 
+  // maps @path over the start of the device, copy-on-write if writable
   void load(const char *path);
+  // copies @len bytes of @mem to @addr, pages of a file loaded into @mem are
+  // mapped copy-on-write instead of copied
   void load(Memory *mem, size_t addr, size_t len);
 
-  void write(char *buf, size_t addr, size_t len);
-  void read(char *buf, size_t addr, size_t len);
+  char *direct(bool write) override;
+
+  void write(char *buf, size_t addr, size_t len) override;
+  void read(char *buf, size_t addr, size_t len) override;
 
-  void write64(uint64_t &dword, size_t addr);
-  void read64(uint64_t &dword, size_t addr);
+  void write64(uint64_t &dword, size_t addr) override {
+    store_le(at<uint64_t>(addr, wen), dword);
+  }
+  void read64(uint64_t &dword, size_t addr) override {
+    dword = load_le<uint64_t>(at<uint64_t>(addr, ren));
+  }
 
-  void write32(uint32_t &word, size_t addr);
-  void read32(uint32_t &word, size_t addr);
+  void write32(uint32_t &word, size_t addr) override {
+    store_le(at<uint32_t>(addr, wen), word);
+  }
+  void read32(uint32_t &word, size_t addr) override {
+    word = load_le<uint32_t>(at<uint32_t>(addr, ren));
+  }
 
-  void write16(uint16_t &hword, size_t addr);
-  void read16(uint16_t &hword, size_t addr);
+  void write16(uint16_t &hword, size_t addr) override {
+    store_le(at<uint16_t>(addr, wen), hword);
+  }
+  void read16(uint16_t &hword, size_t addr) override {
+    hword = load_le<uint16_t>(at<uint16_t>(addr, ren));
+  }
 
-  void write8(uint8_t &byte, size_t addr);
-  void read8(uint8_t &byte, size_t addr);
+  void write8(uint8_t &byte, size_t addr) override {
+    store_le(at<uint8_t>(addr, wen), byte);
+  }
+  void read8(uint8_t &byte, size_t addr) override {
+    byte = load_le<uint8_t>(at<uint8_t>(addr, ren));
+  }
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include "device.hh"
+
+#define NVIC_NR_IRQS 32
+
+// exception numbers
+#define EXC_NMI 2
+#define EXC_HARDFAULT 3
+#define EXC_SVCALL 11
+#define EXC_PENDSV 14
+#define EXC_SYSTICK 15
+#define EXC_IRQ0 16
+#define NR_EXCEPTIONS (EXC_IRQ0 + NVIC_NR_IRQS)
+
+// register offsets from the NVIC base, the SCB is at +0xc00
+#define NVIC_ISER 0x000
+#define NVIC_ICER 0x080
+#define NVIC_ISPR 0x100
+#define NVIC_ICPR 0x180
+#define NVIC_IPR 0x300 // 8 words, one priority byte per irq
+#define SCB_CPUID 0xc00
+#define SCB_ICSR 0xc04
+#define SCB_AIRCR 0xc0c
+#define SCB_SCR 0xc10
+#define SCB_CCR 0xc14
+#define SCB_SHPR2 0xc1c
+#define SCB_SHPR3 0xc20
+
+#define ICSR_PENDSTCLR (1u << 25)
+#define ICSR_PENDSTSET (1u << 26)
+#define ICSR_PENDSVCLR (1u << 27)
+#define ICSR_PENDSVSET (1u << 28)
+#define ICSR_NMIPENDSET (1u << 31)
+
+// The ARMv6-M interrupt controller together with the system control block.
+// Devices pend exceptions here, the core asks at block boundaries which one
+// to take next and reports entries and returns back.
+class Nvic : public RegisterDevice {
+  uint64_t pending = 0; // by exception number
+  uint64_t active = 0;
+  uint32_t enabled = 0; // by irq
+  uint8_t prio[NR_EXCEPTIONS] = {0};
+  uint32_t current = 0; // exception the core is running, ipsr
+  uint32_t scr = 0;
+  std::vector<Device *> sources; // polled for what they pend
+
+  void poll_sources();
+
+  int priority(uint32_t exc) const;
+  // lowest pending exception number of the highest priority, 0 if none
+  uint32_t highest_pending() const;
+
+public:
+  // the core has to call take() once its cycle count reaches this
+  uint64_t check_at = 0;
+
+  Nvic();
+
+  // @src pends its exceptions here from Device::poll
+  void attach(Device *src) { sources.push_back(src); }
+
+  void pend(uint32_t exc);
+  void pend_irq(uint32_t irq) { pend(EXC_IRQ0 + irq); }
+  // something changed that may let a pending exception through
+  void changed() { check_at = 0; }
+
+  // the exception the core should enter now, which becomes active, or 0
+  uint32_t take(bool primask);
+  // the core entered @exc on its own, like svc
+  void enter(uint32_t exc);
+  // the core returned from @exc into code running as @ipsr
+  void retire(uint32_t exc, uint32_t ipsr);
+  // anything pending and enabled, whatever the masks say, as wfi wakes
+  bool wakeup();
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
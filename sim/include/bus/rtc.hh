@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+
+#include "device.hh"
+
+#define RTC_LO 0x0
+#define RTC_HI 0x4
+
+// Microseconds since the board came up, as a 64-bit value in two words.
+// Reading the low word samples the clock and latches the high word with it.
+// The host clock is only asked again once period guest cycles have passed,
+// polling loops in between see the cached value.
+class Rtc : public RegisterDevice {
+  CycleSource cycles;
+  uint64_t period;
+  std::chrono::steady_clock::time_point start;
+  uint64_t sampled = 0; // cycle count at the last host clock read
+  bool fresh = false;   // set once the host clock was read at all
+  uint64_t us = 0;
+  uint32_t hi = 0;
+
+public:
+  Rtc(CycleSource cycles, uint64_t period);
+
+  void resync() override { fresh = false; }
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
@@ -1,23 +1,57 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
 #include "device.hh"
 
+#define SERIAL_RING 4096
+#define SERIAL_BUDGET_MS 20 // longest a byte waits in the ring
+
+// Guest output collects in a ring and reaches the host in chunks: at a
+// newline if @linebuf, when the ring is full, once the oldest byte waited
+// SERIAL_BUDGET_MS, and at exit. With @flusher a background thread does the
+// host writes, otherwise the core does them and poll() watches the budget.
 class Serial : public Device {
-public:
-  Serial(size_t siz);
+  FILE *out;
+  bool linebuf;
 
-  void write(char *buf, size_t addr, size_t len);
-  void read(char *buf, size_t addr, size_t len);
+  char ring[SERIAL_RING];
+  size_t head = 0; // free running, head - tail bytes are waiting
+  size_t tail = 0;
+  std::chrono::steady_clock::time_point oldest; // when the ring filled up from empty
 
-  void write64(uint64_t &dword, size_t addr);
-  void read64(uint64_t &dword, size_t addr);
+  std::mutex lock;  // the ring
+  std::mutex iolock; // order of host writes, taken before lock
+  std::condition_variable kick; // to the flusher
+  std::condition_variable room; // from the flusher
+  bool urgent = false;
+  bool stopping = false;
+  std::thread flusher;
+
+  void push(char c);
+  // empties the ring into @dst, with lock held
+  size_t take(char *dst);
+  void emit(const char *buf, size_t len);
+  // take and emit on the core's thread, without a flusher
+  void drain();
+  void flush_loop();
+
+public:
+  Serial(size_t siz, FILE *out = stdout, bool linebuf = true,
+         bool flusher = false);
+  ~Serial();
 
-  void write32(uint32_t &word, size_t addr);
-  void read32(uint32_t &word, size_t addr);
+  // flushes once the budget ran out, the run loop calls this between quanta
+  void flush_due();
+  void flush();
 
-  void write16(uint16_t &hword, size_t addr);
-  void read16(uint16_t &hword, size_t addr);
+  // the guest went idle, nothing more is coming soon
+  void resync() override { flush_due(); }
 
-  void write8(uint8_t &byte, size_t addr);
-  void read8(uint8_t &byte, size_t addr);
-};
\ No newline at end of file
+  void write(char *buf, size_t addr, size_t len) override;
+  void read(char *buf, size_t addr, size_t len) override;
+};
@@ -1,33 +1,170 @@
 #pragma once
 
+#include <bit>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <string>
 
 #include "device.hh"
 
+#define BUS_PAGE_SHIFT 12
+#define BUS_PAGE_SIZE (1ull << BUS_PAGE_SHIFT)
+#define BUS_PAGE_MASK (BUS_PAGE_SIZE - 1)
+#define BUS_NR_PAGES (1ull << (32 - BUS_PAGE_SHIFT))
+
 class SystemBus {
-  std::map<uint64_t, Device *> iomap;
+  // a registered device and the accesses that reached it, by log2 size
+  struct Port {
+    Device *dev;
+    std::string name;
+    bool rram, wram; // loads / stores go straight to host memory
+    uint64_t reads[4] = {0};
+    uint64_t writes[4] = {0};
+  };
+
+  std::map<uint64_t, Port> iomap;
+  // accesses through the page tables, per page and by log2 size, added to
+  // their ports when dumped. Only allocated when counting.
+  bool counting;
+  uint64_t *pagereads[4] = {nullptr};
+  uint64_t *pagewrites[4] = {nullptr};
+  uint64_t ioreads = 0; // reads that reached a device other than memory
+
+  // host memory of every guest page fully backed by a directly accessible
+  // device, nullptr where the access has to go through finddev
+  char **rpages;
+  char **wpages;
+
+  std::pair<const uint64_t, Port> &finddev(uint64_t addr);
+
+  template <typename T> static char *hostaddr(char **pages, size_t addr) {
+    if (addr >> 32)
+      return nullptr;
+    char *page = pages[addr >> BUS_PAGE_SHIFT];
+    if (!page || (addr & BUS_PAGE_MASK) + sizeof(T) > BUS_PAGE_SIZE)
+      return nullptr;
+    return page + (addr & BUS_PAGE_MASK);
+  }
+
+  template <typename T> void count(uint64_t *const *pages, size_t addr) {
+    if (counting)
+      pages[std::countr_zero(sizeof(T))][addr >> BUS_PAGE_SHIFT] += 1;
+  }
+
+  void mmio_write64(uint64_t &dword, size_t addr);
+  void mmio_read64(uint64_t &dword, size_t addr);
+
+  void mmio_write32(uint32_t &word, size_t addr);
+  void mmio_read32(uint32_t &word, size_t addr);
 
-  std::pair<const uint64_t, Device *> &finddev(uint64_t addr);
+  void mmio_write16(uint16_t &hword, size_t addr);
+  void mmio_read16(uint16_t &hword, size_t addr);
+
+  void mmio_write8(uint8_t &byte, size_t addr);
+  void mmio_read8(uint8_t &byte, size_t addr);
 
 public:
-  SystemBus() = default;
+  SystemBus(bool counting = false);
+  SystemBus(const SystemBus &) = delete;
+  SystemBus &operator=(const SystemBus &) = delete;
+  ~SystemBus();
+
+  void regdev(Device *dev, uint64_t addr, const char *name = nullptr);
+
+  // the access counters as a JSON object, only complete when counting
+  void dump_counters(FILE *fp) const;
+  bool counts() const { return counting; }
+
+  uint64_t io_reads() const { return ioreads; }
+  // the earliest next_event of all devices
+  uint64_t next_event(uint64_t now);
+  void resync();
 
-  void regdev(Device *dev, uint64_t addr);
+  // page tables of the fast path, for code that inlines the lookup
+  char *const *readpages() const { return rpages; }
+  char *const *writepages() const { return wpages; }
+  // and their per page counters of @size byte accesses, when counting
+  uint64_t *readcounts(uint32_t size) const {
+    return pagereads[std::countr_zero(size)];
+  }
+  uint64_t *writecounts(uint32_t size) const {
+    return pagewrites[std::countr_zero(size)];
+  }
 
   void write(char *buf, size_t addr, size_t len);
   void read(char *buf, size_t addr, size_t len);
 
-  void write64(uint64_t &dword, size_t addr);
-  void read64(uint64_t &dword, size_t addr);
+  void write64(uint64_t &dword, size_t addr) {
+    if (char *host = hostaddr<uint64_t>(wpages, addr)) {
+      count<uint64_t>(pagewrites, addr);
+      store_le(host, dword);
+      return;
+    }
+    mmio_write64(dword, addr);
+  }
+
+  void read64(uint64_t &dword, size_t addr) {
+    if (char *host = hostaddr<uint64_t>(rpages, addr)) {
+      count<uint64_t>(pagereads, addr);
+      dword = load_le<uint64_t>(host);
+      return;
+    }
+    mmio_read64(dword, addr);
+  }
+
+  void write32(uint32_t &word, size_t addr) {
+    if (char *host = hostaddr<uint32_t>(wpages, addr)) {
+      count<uint32_t>(pagewrites, addr);
+      store_le(host, word);
+      return;
+    }
+    mmio_write32(word, addr);
+  }
+
+  void read32(uint32_t &word, size_t addr) {
+    if (char *host = hostaddr<uint32_t>(rpages, addr)) {
+      count<uint32_t>(pagereads, addr);
+      word = load_le<uint32_t>(host);
+      return;
+    }
+    mmio_read32(word, addr);
+  }
+
+  void write16(uint16_t &hword, size_t addr) {
+    if (char *host = hostaddr<uint16_t>(wpages, addr)) {
+      count<uint16_t>(pagewrites, addr);
+      store_le(host, hword);
+      return;
+    }
+    mmio_write16(hword, addr);
+  }
 
-  void write32(uint32_t &word, size_t addr);
-  void read32(uint32_t &word, size_t addr);
+  void read16(uint16_t &hword, size_t addr) {
+    if (char *host = hostaddr<uint16_t>(rpages, addr)) {
+      count<uint16_t>(pagereads, addr);
+      hword = load_le<uint16_t>(host);
+      return;
+    }
+    mmio_read16(hword, addr);
+  }
 
-  void write16(uint16_t &hword, size_t addr);
-  void read16(uint16_t &hword, size_t addr);
+  void write8(uint8_t &byte, size_t addr) {
+    if (char *host = hostaddr<uint8_t>(wpages, addr)) {
+      count<uint8_t>(pagewrites, addr);
+      store_le(host, byte);
+      return;
+    }
+    mmio_write8(byte, addr);
+  }
 
-  void write8(uint8_t &byte, size_t addr);
-  void read8(uint8_t &byte, size_t addr);
+  void read8(uint8_t &byte, size_t addr) {
+    if (char *host = hostaddr<uint8_t>(rpages, addr)) {
+      count<uint8_t>(pagereads, addr);
+      byte = load_le<uint8_t>(host);
+      return;
+    }
+    mmio_read8(byte, addr);
+  }
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "device.hh"
+
+class Nvic;
+
+#define SYST_CSR 0x0
+#define SYST_RVR 0x4
+#define SYST_CVR 0x8
+#define SYST_CALIB 0xc
+
+#define SYST_CSR_ENABLE (1u << 0)
+#define SYST_CSR_TICKINT (1u << 1)
+#define SYST_CSR_CLKSOURCE (1u << 2)
+#define SYST_CSR_COUNTFLAG (1u << 16)
+
+// The ARMv6-M SysTick timer, a 24-bit down counter clocked by the core. The
+// counter is not stepped, its value is worked out from the cycles elapsed
+// since the last register write.
+class SysTick : public RegisterDevice {
+  CycleSource cycles;
+  Nvic *nvic;
+  uint32_t csr = SYST_CSR_CLKSOURCE;
+  uint32_t rvr = 0;
+  uint32_t cvr = 0;  // value at base
+  uint64_t base = 0; // cycle count when cvr was latched
+  bool countflag = false;
+  bool fired = false; // like countflag but for the exception, not the guest
+
+  // moves base up to now, latching the counter and COUNTFLAG
+  void latch();
+
+public:
+  // @nvic takes the exception, if there is one
+  SysTick(CycleSource cycles, Nvic *nvic = nullptr);
+
+  uint64_t next_event(uint64_t now) override;
+
+  // pends the exception if the counter reached zero since the last poll
+  void poll() override;
+  // the cycle count of the next exception, ~0 if none is coming
+  uint64_t deadline() override;
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
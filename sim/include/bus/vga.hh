@@ -0,0 +1,182 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device.hh"
+
+#define VGA_WIDTH 400
+#define VGA_HEIGHT 300
+
+#define VGA_CTL_SIZE 0x0 // height in the low half, width in the high half
+#define VGA_CTL_SYNC 0x4
+
+#define CAPTURE_NR_FRAMES 8 // frames in flight between the core and the writer
+
+struct Rect {
+  uint32_t x, y, w, h;
+};
+
+// Gets the screen on every sync together with what changed since the last
+// one, which is all it has to look at. Pixels are 0x00rrggbb little endian.
+class FrameSink {
+public:
+  virtual void frame(const char *pixels, uint32_t width, uint32_t height,
+                     const std::vector<Rect> &dirty) = 0;
+  virtual ~FrameSink() = default;
+};
+
+// Pixel memory by rows. Reads go straight to the pages, writes come through
+// the device and widen the dirty span of each row they touch.
+class Framebuffer : public Device {
+  struct Span {
+    uint32_t lo, hi; // dirty columns, clean if lo >= hi
+  };
+
+  uint32_t width, height;
+  std::vector<char> mem;
+  std::vector<Span> spans;
+  uint32_t top, bottom; // rows that may be dirty
+
+  void mark(size_t addr, size_t len);
+
+  template <typename T> char *at(size_t addr) {
+    if (addr > devsiz - sizeof(T))
+      out_of_range();
+    return mem.data() + addr;
+  }
+
+  [[noreturn]] static void out_of_range();
+
+public:
+  Framebuffer(uint32_t width, uint32_t height);
+
+  uint32_t w() const { return width; }
+  uint32_t h() const { return height; }
+  const char *pixels() const { return mem.data(); }
+
+  // the dirty rectangles since the last call, adjacent dirty rows are merged
+  std::vector<Rect> collect();
+
+  char *direct(bool write) override;
+
+  void write(char *buf, size_t addr, size_t len) override;
+  void read(char *buf, size_t addr, size_t len) override;
+
+  void write32(uint32_t &word, size_t addr) override {
+    store_le(at<uint32_t>(addr), word);
+    mark(addr, sizeof(word));
+  }
+  void read32(uint32_t &word, size_t addr) override {
+    word = load_le<uint32_t>(at<uint32_t>(addr));
+  }
+
+  void write16(uint16_t &hword, size_t addr) override {
+    store_le(at<uint16_t>(addr), hword);
+    mark(addr, sizeof(hword));
+  }
+  void read16(uint16_t &hword, size_t addr) override {
+    hword = load_le<uint16_t>(at<uint16_t>(addr));
+  }
+
+  void write8(uint8_t &byte, size_t addr) override {
+    store_le(at<uint8_t>(addr), byte);
+    mark(addr, sizeof(byte));
+  }
+  void read8(uint8_t &byte, size_t addr) override {
+    byte = load_le<uint8_t>(at<uint8_t>(addr));
+  }
+};
+
+// The screen size and the sync register, a write of non-zero there ends a
+// frame and hands the dirty parts of the framebuffer to the sinks
+class Vga : public RegisterDevice {
+  Framebuffer *fb;
+  std::vector<FrameSink *> sinks;
+  uint64_t frames = 0;
+
+public:
+  Vga(Framebuffer *fb);
+
+  void attach(FrameSink *sink) { sinks.push_back(sink); }
+  uint64_t synced() const { return frames; }
+
+  void write32(uint32_t &word, size_t addr) override;
+  void read32(uint32_t &word, size_t addr) override;
+};
+
+// A binary PPM of the screen mapped shared from a file, only the dirty
+// rectangles are converted on a frame, so the file is also a cheap live
+// view for anything that maps or rereads it
+class PpmSink : public FrameSink {
+  uint32_t width, height;
+  char *map = nullptr;
+  size_t mapsiz = 0;
+  char *rgb = nullptr; // past the header
+
+public:
+  PpmSink(const char *path, uint32_t width, uint32_t height);
+  ~PpmSink();
+
+  void frame(const char *pixels, uint32_t width, uint32_t height,
+             const std::vector<Rect> &dirty);
+};
+
+// The last screen as a PNG, written by finish() or, when the run ends in
+// exit() first, at exit. Frames only convert their dirty rectangles into an
+// rgb copy of the screen, so a sync costs what the guest changed, not an
+// encode.
+class PngSink : public FrameSink {
+  std::string path;
+  uint32_t width, height;
+  std::vector<char> shadow;
+
+public:
+  PngSink(const char *path, uint32_t width, uint32_t height);
+  ~PngSink();
+
+  // writes the file, false if it can not be written
+  bool finish();
+
+  void frame(const char *pixels, uint32_t width, uint32_t height,
+             const std::vector<Rect> &dirty);
+};
+
+// Every frame as @dir/frame-NNNNNN.png. The core converts the dirty
+// rectangles into an rgb copy of the screen and queues a snapshot of it, a
+// writer thread does the encoding. The core waits when all buffers are in
+// flight, so no frame is lost.
+class CaptureSink : public FrameSink {
+  std::string dir;
+  uint32_t width, height;
+  uint64_t limit; // frames to capture, 0 for all
+  uint64_t captured = 0;
+  uint64_t stalls = 0;
+  std::vector<char> shadow;
+
+  std::vector<std::vector<char>> pool;
+  std::vector<std::vector<char> *> spare;
+  std::deque<std::pair<uint64_t, std::vector<char> *>> full;
+  std::mutex lock;
+  std::condition_variable ready; // to the writer
+  std::condition_variable freed; // from the writer
+  bool done = false;
+  std::thread writer;
+
+  void drain();
+
+public:
+  CaptureSink(const char *dir, uint32_t width, uint32_t height,
+              uint64_t limit = 0);
+  ~CaptureSink();
+
+  // times the core waited for the writer
+  uint64_t stalled() const { return stalls; }
+
+  void frame(const char *pixels, uint32_t width, uint32_t height,
+             const std::vector<Rect> &dirty);
+};
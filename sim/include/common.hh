@@ -8,11 +8,26 @@
 #include "bus/sysbus.hh"
 #include "bus/memory.hh"
 #include "bus/serial.hh"
+#include "bus/systick.hh"
+#include "bus/dwt.hh"
+#include "bus/rtc.hh"
+#include "bus/nvic.hh"
+#include "bus/vga.hh"
+#include "bus/keyboard.hh"
+#include "bus/audio.hh"
 
 #define RAM_ADDR 0x0000'0000
 #define IMG_ADDR 0x0000'8000
 #define STK_ADDR 0x2000'0000
 
+// nominal core clock, the cycles an instruction takes are set by --cpi
+#define CPU_HZ 50'000'000u
+
+// private peripheral bus
+#define DWT_ADDR     0xe000'1000
+#define SYSTICK_ADDR 0xe000'e010
+#define NVIC_ADDR    0xe000'e100
+
 #define DEVICE_BASE 0xa0000000
 #define MMIO_BASE 0xa0000000
 
@@ -25,14 +40,30 @@
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
 
+// nvic irq lines
+#define KBD_IRQ 0
+#define AUDIO_IRQ 1
+
+// On a thread that set panic_throws a panic unwinds to whoever runs the
+// guest there, so one bad image does not end a batch. Everywhere else it
+// ends the process.
+struct Panic : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+extern thread_local bool panic_throws;
+
 #define panic(x) do {   \
   Log(x);               \
+  if (panic_throws)     \
+    throw Panic(x);     \
   exit(EXIT_FAILURE);   \
 } while (0)
 
 #define panicifnot(cond) do {   \
     if (!(cond)) {                 \
         Log(#cond " fail");     \
+        if (panic_throws)       \
+          throw Panic(#cond " fail"); \
         exit(EXIT_FAILURE);     \
     }                           \
 } while (0)
@@ -2,9 +2,35 @@
 
 #include "gcpu.hh"
 #include "../bus/sysbus.hh"
+#include "../bus/nvic.hh"
+
+struct CpuState;
+
+struct CpuOptions {
+  bool jit = false;                // translate hot blocks to host code
+  bool trace = false;              // rolling trace, dumped when the core dies
+  const char *tracefile = nullptr; // stream the full trace to this file
+  const char *profelf = nullptr;   // sample a profile symbolised by this elf
+  // instructions between samples, taken at block boundaries, so a period
+  // shorter than a block piles samples onto the block's successor
+  uint64_t profperiod = 10000;
+  const char *profout = "profile"; // writes <profout>.flat and .folded
+  uint32_t cpi = 1;                // guest cycles per retired instruction
+  bool idleskip = true;            // skip or sleep through idle loops
+};
 
 class Cortex_M0 : public Gcpu {
+  CpuState *state;
+
 public:
-  Cortex_M0(SystemBus *bus);
-  void Step(unsigned in);
+  // @nvic delivers interrupts, a core without one only knows svc
+  Cortex_M0(SystemBus *bus, Nvic *nvic, const CpuOptions &opts = {});
+  Cortex_M0(const Cortex_M0 &) = delete;
+  Cortex_M0 &operator=(const Cortex_M0 &) = delete;
+  ~Cortex_M0();
+  unsigned Step(unsigned in);
+  bool Halted();
+  uint32_t ExitCode();
+  uint64_t Cycles();
+  void DumpCounters(FILE *fp);
 };
\ No newline at end of file
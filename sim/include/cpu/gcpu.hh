@@ -1,9 +1,20 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+
 class Gcpu {
 
 public:
   Gcpu() = default;
   virtual ~Gcpu() = default;
-  virtual void Step(unsigned in) = 0;
+  // run up to @in instructions, returns how many were retired
+  virtual unsigned Step(unsigned in) = 0;
+  virtual bool Halted() = 0;
+  // guest supplied status, valid once halted
+  virtual uint32_t ExitCode() = 0;
+  // guest clock cycles so far, exact even from inside a device access
+  virtual uint64_t Cycles() = 0;
+  // the core's performance counters as a JSON object
+  virtual void DumpCounters(FILE *fp) = 0;
 };
\ No newline at end of file
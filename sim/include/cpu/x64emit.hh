@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace x64 {
+
+enum Reg {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8,  R9,  R10, R11, R12, R13, R14, R15,
+};
+
+enum Cond {
+  CC_O  = 0x0,
+  CC_NO = 0x1,
+  CC_C  = 0x2,
+  CC_NC = 0x3,
+  CC_E  = 0x4,
+  CC_NE = 0x5,
+  CC_S  = 0x8,
+  CC_NS = 0x9,
+};
+
+enum Alu {
+  ALU_ADD = 0,
+  ALU_OR  = 1,
+  ALU_AND = 4,
+  ALU_SUB = 5,
+  ALU_XOR = 6,
+  ALU_CMP = 7,
+};
+
+enum Shift {
+  SH_SHL = 4,
+  SH_SHR = 5,
+  SH_SAR = 7,
+};
+
+// Appends x86-64 machine code to an executable buffer. Unless noted the
+// operand size is 32 bits, which zero-extends into the full register.
+class Emitter {
+  uint8_t *buf;
+  size_t cap;
+  size_t pos = 0;
+
+  void rex(bool w, int reg, int index, int base, bool force = false);
+  void modrm_reg(int reg, int rm);
+  void modrm_mem(int reg, Reg base, int32_t disp);
+  void modrm_sib(int reg, Reg base, Reg index, int scale);
+
+public:
+  Emitter(size_t siz);
+  ~Emitter();
+
+  uint8_t *cur() { return buf + pos; }
+  size_t room() { return cap - pos; }
+  void reset() { pos = 0; }
+
+  void byte(uint8_t b);
+  void dword(uint32_t d);
+  void qword(uint64_t q);
+
+  void push(Reg r);
+  void pop(Reg r);
+  void ret();
+  void adjust_rsp(int8_t imm);
+  void call(const void *fn);
+
+  // mov r32, r32 / mov r64, r64 / mov r32, imm32 / mov r64, imm64
+  void mov(Reg dst, Reg src);
+  void mov_ptr(Reg dst, Reg src);
+  void mov_imm(Reg dst, uint32_t imm);
+  void mov_imm64(Reg dst, uint64_t imm);
+
+  // mov r32, [base + disp] / mov [base + disp], r32 and immediates
+  void load(Reg dst, Reg base, int32_t disp);
+  void store(Reg base, int32_t disp, Reg src);
+  void store_imm(Reg base, int32_t disp, uint32_t imm);
+  void store8_imm(Reg base, int32_t disp, uint8_t imm);
+  void cmp8_imm(Reg base, int32_t disp, uint8_t imm);
+  void setcc(Cond cc, Reg base, int32_t disp);
+  void cmovcc(Cond cc, Reg dst, Reg base, int32_t disp);
+
+  // mov r64, [base + index * 8]
+  void load_ptr(Reg dst, Reg base, Reg index);
+  // 1, 2 or 4 byte access at [base + index], loads zero or sign extend
+  void load_idx(int size, bool sext, Reg dst, Reg base, Reg index);
+  void store_idx(int size, Reg base, Reg index, Reg src);
+  // inc qword [base + index * 8]
+  void inc_idx(Reg base, Reg index);
+  // bt [base], r64
+  void bt(Reg base, Reg bit);
+
+  void alu(Alu op, Reg dst, Reg src);
+  void alu_imm(Alu op, Reg dst, uint32_t imm);
+  void shift(Shift op, Reg dst, uint8_t imm);
+  void not_(Reg r);
+  void imul(Reg dst, Reg src);
+  void test(Reg a, Reg b);
+  void test_ptr(Reg a, Reg b);
+  void test_imm(Reg r, uint32_t imm);
+  // movzx / movsx r32, r8 or r16
+  void extend(int size, bool sext, Reg dst, Reg src);
+
+  // forward jumps, returns the rel32 slot to hand to bind()
+  uint8_t *jcc(Cond cc);
+  uint8_t *jmp();
+  void bind(uint8_t *slot);
+};
+
+} // namespace x64
@@ -1,27 +1,95 @@
 #pragma once
 
-#include <deque>
-#include <string>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
+// Keeps the most recent trace records in preallocated rings, formatting only
+// happens in pallmsg()
 class Debugger32 {
 private:
-  std::deque<std::string> memque;
-  std::deque<std::string> instque;
-  std::deque<std::string> jmpque;
-  std::deque<std::string> regque;
+  struct InstRecord {
+    uint32_t addr;
+    uint32_t inst;
+  };
+
+  struct MemRecord {
+    uint32_t pc;
+    uint32_t addr;
+    uint32_t data;
+    bool read;
+  };
+
+  struct JmpRecord {
+    uint32_t pc;
+    uint32_t target;
+  };
+
+  // r0-r12, sp, lr and the instruction address around one instruction
+  struct RegRecord {
+    uint32_t before[16];
+    uint32_t after[16];
+  };
+
+  template <typename T> class Ring {
+    std::vector<T> buf;
+    size_t pos = 0;
+    bool full = false;
+
+  public:
+    void resize(size_t len) {
+      buf.assign(len, T{});
+      pos = 0;
+      full = false;
+    }
+
+    T &push() {
+      T &rec = buf[pos];
+      if (++pos == buf.size()) {
+        pos = 0;
+        full = true;
+      }
+      return rec;
+    }
+
+    size_t size() const { return full ? buf.size() : pos; }
+    bool empty() const { return size() == 0; }
+
+    // oldest first
+    const T &operator[](size_t i) const {
+      return buf[full ? (pos + i) % buf.size() : i];
+    }
+  };
+
+  Ring<MemRecord> memque;
+  Ring<InstRecord> instque;
+  Ring<JmpRecord> jmpque;
+  Ring<RegRecord> regque;
 
-  uint32_t maxlen = 50;
   uint32_t curaddr = 0;
+  uint32_t pass = 0; // instructions left to skip without prompting
+  bool stepping = false; // the user is at the prompt between instructions
+  bool armed = false;
+
+  static volatile sig_atomic_t interrupted;
 
 public:
   Debugger32();
   ~Debugger32();
   void pushjmp(uint32_t addr);
-  void pushreg(std::string msg);
+  void pushreg(const uint32_t *before, const uint32_t *after);
   void pushinst(uint32_t inst);
   void pushmem(uint32_t addr, uint32_t data, bool memi);
   void setaddr(uint32_t addr);
+  // allocates the rings, nothing can be pushed before
   void setqlen(uint32_t len);
+  // dump the trace if this thread exits on a panic while we are alive
+  void arm();
+  // Ctrl-C stops the traced core at its next instruction, until then the
+  // rings record without prompting
+  static void catch_interrupt();
+  bool stopped() const { return stepping || interrupted; }
   void getopt();
   void pallmsg();
-};
\ No newline at end of file
+};
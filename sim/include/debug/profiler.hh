@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Samples the guest pc every period instructions together with a shadow call
+// stack kept from calls and returns, and resolves both against the function
+// symbols of the guest ELF when reporting.
+class Profiler {
+  struct Symbol {
+    uint32_t addr;
+    uint32_t size;
+    std::string name;
+  };
+
+  struct Frame {
+    uint32_t func;
+    uint32_t ret;
+  };
+
+  std::vector<Symbol> symbols; // sorted by address
+  std::vector<Frame> stack;
+  // outermost function first, sampled pc last
+  std::map<std::vector<uint32_t>, uint64_t> samples;
+  uint64_t nsamples = 0;
+
+  int64_t period;
+  int64_t countdown;
+
+  void load_symbols(const char *elf);
+  std::string symbolize(uint32_t addr) const;
+  void sample(uint32_t pc);
+
+public:
+  Profiler(const char *elf, uint64_t period);
+
+  // @n instructions retired, the next one is at @pc. The core only calls
+  // this between blocks, so every sample due in the block lands on @pc.
+  void tick(uint32_t pc, uint32_t n) {
+    for (countdown -= n; countdown <= 0; countdown += period)
+      sample(pc);
+  }
+
+  void call(uint32_t func, uint32_t ret);
+  void ret(uint32_t target);
+
+  // writes @prefix.flat and @prefix.folded
+  void report(const char *prefix) const;
+};
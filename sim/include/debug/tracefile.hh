@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+// On-disk execution trace. The file is a header followed by independently
+// deflated blocks:
+//
+//   header  "SIMTRACE" u32 version
+//   block   u32 rawsize u32 compsize u64 lost, compsize bytes of deflate
+//
+// All integers are little endian, lost counts the records dropped right
+// before the block. Inside a block every record is a varint whose low bit
+// tells its kind, deltas restart from zero at each block:
+//
+//   inst    (zigzag(pc - expected pc) << 1 | is32) << 1 | 0, then the opcode
+//           in 2 or 4 bytes, the expected pc follows the previous instruction
+//   mem     (zigzag(addr - last addr) << 3 | log2 size << 1 | write) << 1 | 1,
+//           varint data
+
+#define TRACE_MAGIC "SIMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_SIZE (64 << 10)
+#define TRACE_MAX_RECORD 16 // bytes one record may encode to
+#define TRACE_NR_BLOCKS 256 // blocks in flight between the core and the writer
+
+namespace etrace {
+
+inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+// nullptr when the varint runs past @end
+inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end,
+                                 uint64_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return p;
+  }
+  return nullptr;
+}
+
+inline uint64_t zigzag(int64_t v) { return (uint64_t)v << 1 ^ (v >> 63); }
+
+inline int64_t unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+struct Block {
+  uint8_t raw[TRACE_BLOCK_SIZE];
+  size_t len;
+  uint64_t lost;
+};
+
+// Single producer, single consumer ring of block pointers, only the producer
+// moves tail and only the consumer moves head
+class Queue {
+  Block *slots[TRACE_NR_BLOCKS + 1];
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+
+public:
+  bool push(Block *blk) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t next = (t + 1) % std::size(slots);
+    if (next == head.load(std::memory_order_acquire))
+      return false;
+    slots[t] = blk;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  Block *pop() {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return nullptr;
+    Block *blk = slots[h];
+    head.store((h + 1) % std::size(slots), std::memory_order_release);
+    return blk;
+  }
+};
+
+// Encodes records on the simulation thread and hands full blocks to a writer
+// thread that deflates them to disk. When the writer falls behind, blocks are
+// dropped and counted instead of stalling the core.
+class Writer {
+  FILE *fp;
+  Queue full;  // core to writer
+  Queue spare; // writer back to core
+  Block *pool;
+  Block *cur;
+  uint8_t *pos;
+  uint32_t nextpc = 0;
+  uint32_t lastaddr = 0;
+  uint64_t lost = 0;     // records dropped since the last block got through
+  uint64_t records = 0;  // records in cur
+  uint64_t dropped = 0;  // records dropped in total
+  std::atomic<bool> done{false};
+  std::thread worker;
+
+  void reset();
+  void flush();
+  void drain();
+
+public:
+  Writer(const char *path);
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+  ~Writer();
+
+  void inst(uint32_t pc, uint32_t opcode, bool is32) {
+    if (pos > cur->raw + TRACE_BLOCK_SIZE - TRACE_MAX_RECORD)
+      flush();
+    pos = put_varint(pos, (zigzag((int32_t)(pc - nextpc)) << 1 | is32) << 1);
+    for (int i = 0; i < (is32 ? 4 : 2); ++i)
+      *pos++ = opcode >> (i * 8);
+    nextpc = pc + (is32 ? 4 : 2);
+    records += 1;
+  }
+
+  void mem(uint32_t addr, uint32_t data, uint32_t size, bool write) {
+    if (pos > cur->raw + TRACE_BLOCK_SIZE - TRACE_MAX_RECORD)
+      flush();
+    uint32_t lg = size == 4 ? 2 : size == 2 ? 1 : 0;
+    uint64_t delta = zigzag((int32_t)(addr - lastaddr));
+    pos = put_varint(pos, (delta << 3 | lg << 1 | write) << 1 | 1);
+    pos = put_varint(pos, data);
+    lastaddr = addr;
+    records += 1;
+  }
+};
+
+} // namespace etrace
@@ -0,0 +1,204 @@
+#include "bus/audio.hh"
+#include "common.hh"
+
+//
+// ----- ----- WavWriter ----- -----
+//
+
+#define WAV_HEADER 44
+
+WavWriter::WavWriter(const char *path) : ring(AUDIO_WAV_RING) {
+  fp = fopen(path, "wb");
+  if (!fp)
+    panic("can not open audio output");
+  // the header is only known at the end
+  char header[WAV_HEADER] = {};
+  fwrite(header, 1, sizeof(header), fp);
+  writer = std::thread(&WavWriter::drain, this);
+}
+
+WavWriter::~WavWriter() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+  }
+  ready.notify_one();
+  writer.join();
+
+  char header[WAV_HEADER];
+  memcpy(header, "RIFF", 4);
+  store_le<uint32_t>(header + 4, WAV_HEADER - 8 + written);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  store_le<uint32_t>(header + 16, 16);
+  store_le<uint16_t>(header + 20, 1); // pcm
+  store_le<uint16_t>(header + 22, channels);
+  store_le<uint32_t>(header + 24, freq);
+  store_le<uint32_t>(header + 28, freq * channels * 2);
+  store_le<uint16_t>(header + 32, channels * 2);
+  store_le<uint16_t>(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  store_le<uint32_t>(header + 40, written);
+  fseek(fp, 0, SEEK_SET);
+  fwrite(header, 1, sizeof(header), fp);
+  fclose(fp);
+}
+
+// only read once the writer is gone
+void WavWriter::format(uint32_t freq, uint32_t channels) {
+  this->freq = freq;
+  this->channels = channels;
+}
+
+void WavWriter::push(const char *buf, size_t len) {
+  while (len) {
+    std::unique_lock<std::mutex> guard(lock);
+    freed.wait(guard, [this] { return head - tail < ring.size(); });
+    size_t n = std::min(len, ring.size() - (head - tail));
+    size_t from = head % ring.size();
+    size_t first = std::min(n, ring.size() - from);
+    memcpy(ring.data() + from, buf, first);
+    memcpy(ring.data(), buf + first, n - first);
+    head += n;
+    ready.notify_one();
+    buf += n;
+    len -= n;
+  }
+}
+
+void WavWriter::drain() {
+  std::vector<char> chunk(ring.size());
+  for (;;) {
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait(guard, [this] { return done || head != tail; });
+    // the core pushes its last samples before raising done
+    if (head == tail)
+      break;
+    size_t len = head - tail;
+    size_t from = tail % ring.size();
+    size_t first = std::min(len, ring.size() - from);
+    memcpy(chunk.data(), ring.data() + from, first);
+    memcpy(chunk.data() + first, ring.data(), len - first);
+    tail = head;
+    freed.notify_one();
+    guard.unlock();
+
+    fwrite(chunk.data(), 1, len, fp);
+    written += len;
+  }
+}
+
+//
+// ----- ----- Audio ----- -----
+//
+
+Audio::Audio(CycleSource cycles, Nvic *nvic, uint32_t irq, Device *sbuf,
+             WavWriter *wav)
+    : RegisterDevice(0x20), cycles(cycles), nvic(nvic), irq(irq),
+      sbuf(sbuf->direct(false)), wav(wav) {
+  panicifnot(this->sbuf && sbuf->size() == AUDIO_SBUF_BYTES);
+  if (nvic)
+    nvic->attach(this);
+}
+
+// what is still queued is played out
+Audio::~Audio() { emit(head - tail); }
+
+void Audio::emit(uint64_t len) {
+  if (wav && len) {
+    size_t from = tail % AUDIO_SBUF_BYTES;
+    size_t first = std::min<uint64_t>(len, AUDIO_SBUF_BYTES - from);
+    wav->push(sbuf + from, first);
+    wav->push(sbuf, len - first);
+  }
+  tail += len;
+}
+
+// a period with nothing queued passes as silence, which is not written out
+void Audio::play() {
+  if (!running)
+    return;
+  uint64_t periods = (cycles() - base) / pcycles;
+  if (!periods)
+    return;
+  base += periods * pcycles;
+  uint64_t len = std::min(head - tail, periods * pbytes);
+  freed |= len != 0;
+  emit(len);
+}
+
+// the next period boundary, where room opens up
+uint64_t Audio::next_event(uint64_t now) {
+  if (!running || head == tail)
+    return ~0ull;
+  return base + ((now - base) / pcycles + 1) * pcycles;
+}
+
+void Audio::poll() {
+  play();
+  if (freed)
+    nvic->pend_irq(irq);
+  freed = false;
+}
+
+uint64_t Audio::deadline() { return next_event(cycles()); }
+
+void Audio::write32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case AUDIO_FREQ:
+    freq = word;
+    break;
+  case AUDIO_CHANNELS:
+    channels = word;
+    break;
+  case AUDIO_SAMPLES:
+    samples = word;
+    break;
+  case AUDIO_INIT:
+    // a new stream, the old one plays out first
+    play();
+    emit(head - tail);
+    running = word && freq && channels && samples;
+    if (!running)
+      break;
+    pbytes = samples * channels * 2;
+    pcycles = std::max<uint64_t>((uint64_t)samples * CPU_HZ / freq, 1);
+    base = cycles();
+    head = tail = 0;
+    if (wav)
+      wav->format(freq, channels);
+    break;
+  case AUDIO_COMMIT:
+    play();
+    head += std::min<uint64_t>(word, AUDIO_SBUF_BYTES - (head - tail));
+    break;
+  }
+}
+
+void Audio::read32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case AUDIO_FREQ:
+    word = freq;
+    break;
+  case AUDIO_CHANNELS:
+    word = channels;
+    break;
+  case AUDIO_SAMPLES:
+    word = samples;
+    break;
+  case AUDIO_SBUF_SIZE:
+    word = AUDIO_SBUF_BYTES;
+    break;
+  case AUDIO_INIT:
+    word = running;
+    break;
+  case AUDIO_COUNT:
+    play();
+    word = head - tail;
+    break;
+  case AUDIO_HEAD:
+    word = head % AUDIO_SBUF_BYTES;
+    break;
+  default:
+    word = 0;
+  }
+}
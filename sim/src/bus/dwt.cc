@@ -0,0 +1,37 @@
+#include "bus/dwt.hh"
+#include "common.hh"
+
+Dwt::Dwt(CycleSource cycles) : RegisterDevice(0x8), cycles(cycles) {}
+
+uint32_t Dwt::count() {
+  if (!(ctrl & DWT_CTRL_CYCCNTENA))
+    return cyccnt;
+  return cyccnt + (uint32_t)(cycles() - base);
+}
+
+void Dwt::write32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case DWT_CTRL:
+    cyccnt = count();
+    base = cycles();
+    ctrl = word & DWT_CTRL_CYCCNTENA;
+    break;
+  case DWT_CYCCNT:
+    cyccnt = word;
+    base = cycles();
+    break;
+  }
+}
+
+void Dwt::read32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case DWT_CTRL:
+    word = ctrl;
+    break;
+  case DWT_CYCCNT:
+    word = count();
+    break;
+  default:
+    word = 0;
+  }
+}
@@ -0,0 +1,89 @@
+#include "bus/keyboard.hh"
+#include "common.hh"
+
+#define KEY_NAME(key) #key,
+static const char *keynames[] = {"NONE", KBD_KEYS(KEY_NAME)};
+#undef KEY_NAME
+
+Keyboard::Keyboard(CycleSource cycles, Nvic *nvic, uint32_t irq,
+                   std::vector<KeyEvent> script)
+    : RegisterDevice(0x4), cycles(cycles), nvic(nvic), irq(irq),
+      script(script.begin(), script.end()) {
+  if (nvic)
+    nvic->attach(this);
+}
+
+bool Keyboard::parse(const char *path, std::vector<KeyEvent> &events,
+                     std::string &err) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    err = std::string("can not open ") + path;
+    return false;
+  }
+
+  size_t lineno = 0;
+  for (std::string line; std::getline(ifs, line);) {
+    lineno += 1;
+    auto bad = [&](const char *why) {
+      err = std::string(path) + ":" + std::to_string(lineno) + ": " + why;
+      return false;
+    };
+
+    std::istringstream iss(line.substr(0, line.find('#')));
+    std::string key, action;
+    KeyEvent ev;
+    if (!(iss >> ev.at)) {
+      if (iss.eof())
+        continue; // nothing but blanks
+      return bad("expected cycle, key and d or u");
+    }
+    if (!(iss >> key >> action))
+      return bad("expected cycle, key and d or u");
+    if (action != "d" && action != "u")
+      return bad("the action is d or u");
+    if (!events.empty() && ev.at < events.back().at)
+      return bad("events go back in time");
+
+    auto name = std::find(std::begin(keynames), std::end(keynames), key);
+    char *end;
+    unsigned long code = strtoul(key.c_str(), &end, 0);
+    if (name != std::end(keynames))
+      code = name - std::begin(keynames);
+    else if (*end || code > KBD_KEYCODE_MASK)
+      return bad("unknown key");
+    ev.code = code;
+    ev.down = action == "d";
+    events.push_back(ev);
+  }
+  return true;
+}
+
+uint64_t Keyboard::next_event(uint64_t now) {
+  if (script.empty())
+    return ~0ull;
+  return std::max(script.front().at, now);
+}
+
+void Keyboard::poll() {
+  if (!script.empty() && script.front().at <= cycles())
+    nvic->pend_irq(irq);
+}
+
+// the queued keys are at the front, a pending irq stands for them
+uint64_t Keyboard::deadline() {
+  auto next = std::upper_bound(
+      script.begin(), script.end(), cycles(),
+      [](uint64_t now, const KeyEvent &ev) { return now < ev.at; });
+  return next == script.end() ? ~0ull : next->at;
+}
+
+void Keyboard::write32(uint32_t &word, size_t addr) {}
+
+void Keyboard::read32(uint32_t &word, size_t addr) {
+  word = 0;
+  if (addr != KBD_DATA || script.empty() || script.front().at > cycles())
+    return;
+  const KeyEvent &ev = script.front();
+  word = ev.code | (ev.down ? KBD_KEYDOWN_MASK : 0);
+  script.pop_front();
+}
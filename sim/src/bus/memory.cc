@@ -1,24 +1,67 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "bus/memory.hh"
 #include "common.hh"
 
+static const size_t pagesiz = sysconf(_SC_PAGESIZE);
+
+static size_t pageup(size_t len) { return (len + pagesiz - 1) & ~(pagesiz - 1); }
+
+// anonymous pages read as zero and are only backed once touched
 Memory::Memory(size_t siz, bool w, bool r, bool x)
     : Device(siz), wen(w), ren(r), xen(x) {
-  data = new char[siz];
-  memset((void *)data, 0, siz);
+  void *p = mmap(nullptr, siz, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    panic("can not map memory");
+  data = (char *)p;
 }
 
 void Memory::load(const char *path) {
-  std::fstream ifs(path, std::ios::in | std::ios::binary);
-  panicifnot(ifs);
-  ifs.read(data, devsiz);
-  ifs.close();
+  panicifnot(fd < 0);
+  fd = open(path, O_RDONLY);
+  panicifnot(fd >= 0);
+
+  struct stat st;
+  panicifnot(fstat(fd, &st) == 0);
+  filesiz = std::min((size_t)st.st_size, devsiz);
+  if (!filesiz)
+    return;
+
+  // the tail of the last page reads as zero, pages past it stay anonymous
+  int prot = wen ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *p = mmap(data, pageup(filesiz), prot, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  panicifnot(p != MAP_FAILED);
 }
 
 void Memory::load(Memory *mem, size_t addr, size_t len) {
   panicifnot(addr + len < devsiz);
-  memcpy(&data[addr], mem->data, len);
+  panicifnot(len <= mem->devsiz);
+
+  // a read-only device still holds exactly its file followed by zeros
+  size_t mapped = 0;
+  if (mem->fd >= 0 && !mem->wen && addr % pagesiz == 0) {
+    mapped = len & ~(pagesiz - 1);
+    size_t filepart = std::min(pageup(mem->filesiz), mapped);
+    void *p = data + addr;
+    if (filepart)
+      p = mmap(p, filepart, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+               mem->fd, 0);
+    panicifnot(p != MAP_FAILED);
+    if (mapped > filepart)
+      p = mmap(data + addr + filepart, mapped - filepart,
+               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+               -1, 0);
+    panicifnot(p != MAP_FAILED);
+  }
+  memcpy(&data[addr + mapped], &mem->data[mapped], len - mapped);
 }
 
+char *Memory::direct(bool write) { return (write ? wen : ren) ? data : nullptr; }
+
 void Memory::write(char *buf, size_t addr, size_t len) {
   if (!wen)
     panic("permission denied");
@@ -33,70 +76,12 @@ void Memory::read(char *buf, size_t addr, size_t len) {
   memcpy(buf, &data[addr], actlen);
 }
 
-Memory::~Memory() { delete[] data; }
-
-void Memory::write64(uint64_t &dword, size_t addr) {
-  uint8_t buf[sizeof(dword)];
-  buf[0] = (dword >> 0) & 0xFF;
-  buf[1] = (dword >> 8) & 0xFF;
-  buf[2] = (dword >> 16) & 0xFF;
-  buf[3] = (dword >> 24) & 0xFF;
-  buf[4] = (dword >> 32) & 0xFF;
-  buf[5] = (dword >> 40) & 0xFF;
-  buf[6] = (dword >> 48) & 0xFF;
-  buf[7] = (dword >> 56) & 0xFF;
-  write((char *)buf, addr, sizeof(dword));
-}
-
-void Memory::read64(uint64_t &dword, size_t addr) {
-  uint8_t buf[sizeof(dword)];
-  read((char *)buf, addr, sizeof(dword));
-  dword = (uint64_t)buf[0];
-  dword |= (uint64_t)buf[1] << 8;
-  dword |= (uint64_t)buf[2] << 16;
-  dword |= (uint64_t)buf[3] << 24;
-  dword |= (uint64_t)buf[4] << 32;
-  dword |= (uint64_t)buf[5] << 40;
-  dword |= (uint64_t)buf[6] << 48;
-  dword |= (uint64_t)buf[7] << 56;
+Memory::~Memory() {
+  munmap(data, devsiz);
+  if (fd >= 0)
+    close(fd);
 }
 
-void Memory::write32(uint32_t &word, size_t addr) {
-  uint8_t buf[sizeof(word)];
-  buf[0] = (word >> 0) & 0xFF;
-  buf[1] = (word >> 8) & 0xFF;
-  buf[2] = (word >> 16) & 0xFF;
-  buf[3] = (word >> 24) & 0xFF;
-  write((char *)buf, addr, sizeof(word));
-}
-
-void Memory::read32(uint32_t &word, size_t addr) {
-  uint8_t buf[sizeof(word)];
-  read((char *)buf, addr, sizeof(word));
-  word = buf[0];
-  word |= buf[1] << 8;
-  word |= buf[2] << 16;
-  word |= buf[3] << 24;
-}
-
-void Memory::write16(uint16_t &hword, size_t addr) {
-  uint8_t buf[sizeof(hword)];
-  buf[0] = (hword >> 0) & 0xFF;
-  buf[1] = (hword >> 8) & 0xFF;
-  write((char *)buf, addr, sizeof(hword));
-}
-
-void Memory::read16(uint16_t &hword, size_t addr) {
-  uint8_t buf[sizeof(hword)];
-  read((char *)buf, addr, sizeof(hword));
-  hword = buf[0];
-  hword |= buf[1] << 8;
-}
-
-void Memory::write8(uint8_t &byte, size_t addr) {
-  write((char *)&byte, addr, sizeof(byte));
-}
+void Memory::permission_denied() { panic("permission denied"); }
 
-void Memory::read8(uint8_t &byte, size_t addr) {
-  read((char *)&byte, addr, sizeof(byte));
-}
\ No newline at end of file
+void Memory::out_of_range() { panic("access out of range"); }
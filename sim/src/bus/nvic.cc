@@ -0,0 +1,171 @@
+#include "bus/nvic.hh"
+#include "common.hh"
+
+Nvic::Nvic() : RegisterDevice(0xc40) {}
+
+int Nvic::priority(uint32_t exc) const {
+  if (exc == EXC_NMI)
+    return -2;
+  if (exc == EXC_HARDFAULT)
+    return -1;
+  return prio[exc];
+}
+
+uint32_t Nvic::highest_pending() const {
+  uint64_t ready = pending & ~((uint64_t)~enabled << EXC_IRQ0);
+  uint32_t best = 0;
+  for (; ready; ready &= ready - 1) {
+    uint32_t exc = std::countr_zero(ready);
+    if (!best || priority(exc) < priority(best))
+      best = exc;
+  }
+  return best;
+}
+
+void Nvic::poll_sources() {
+  for (auto &&src : sources)
+    src->poll();
+}
+
+void Nvic::pend(uint32_t exc) {
+  panicifnot(exc < NR_EXCEPTIONS);
+  pending |= 1ull << exc;
+  changed();
+}
+
+uint32_t Nvic::take(bool primask) {
+  poll_sources();
+
+  // the running priority is that of the most urgent active exception,
+  // primask raises it to 0
+  int running = 256;
+  for (uint64_t act = active; act; act &= act - 1)
+    running = std::min(running, priority(std::countr_zero(act)));
+  if (primask)
+    running = std::min(running, 0);
+
+  uint32_t exc = highest_pending();
+  if (exc && priority(exc) < running) {
+    pending &= ~(1ull << exc);
+    active |= 1ull << exc;
+    current = exc;
+    return exc;
+  }
+
+  // nothing can come through until a register or a mask changes, or a
+  // source has something new
+  check_at = ~0ull;
+  for (auto &&src : sources)
+    check_at = std::min(check_at, src->deadline());
+  return 0;
+}
+
+void Nvic::enter(uint32_t exc) {
+  active |= 1ull << exc;
+  current = exc;
+}
+
+void Nvic::retire(uint32_t exc, uint32_t ipsr) {
+  active &= ~(1ull << exc);
+  current = ipsr;
+  changed();
+}
+
+bool Nvic::wakeup() {
+  poll_sources();
+  return highest_pending() != 0;
+}
+
+void Nvic::write32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case NVIC_ISER:
+    enabled |= word;
+    break;
+  case NVIC_ICER:
+    enabled &= ~word;
+    break;
+  case NVIC_ISPR:
+    pending |= (uint64_t)word << EXC_IRQ0;
+    break;
+  case NVIC_ICPR:
+    pending &= ~((uint64_t)word << EXC_IRQ0);
+    break;
+  case NVIC_IPR ... NVIC_IPR + 0x1c:
+    // only the top two bits of a priority are implemented
+    for (int i = 0; i < 4; ++i)
+      prio[EXC_IRQ0 + (addr - NVIC_IPR) + i] = word >> (i * 8) & 0xc0;
+    break;
+  case SCB_ICSR:
+    if (word & ICSR_NMIPENDSET)
+      pending |= 1ull << EXC_NMI;
+    if (word & ICSR_PENDSVSET)
+      pending |= 1ull << EXC_PENDSV;
+    if (word & ICSR_PENDSVCLR)
+      pending &= ~(1ull << EXC_PENDSV);
+    if (word & ICSR_PENDSTSET)
+      pending |= 1ull << EXC_SYSTICK;
+    if (word & ICSR_PENDSTCLR)
+      pending &= ~(1ull << EXC_SYSTICK);
+    break;
+  case SCB_SCR:
+    scr = word & 0x16;
+    break;
+  case SCB_SHPR2:
+    prio[EXC_SVCALL] = word >> 24 & 0xc0;
+    break;
+  case SCB_SHPR3:
+    prio[EXC_PENDSV] = word >> 16 & 0xc0;
+    prio[EXC_SYSTICK] = word >> 24 & 0xc0;
+    break;
+  }
+  changed();
+}
+
+void Nvic::read32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case NVIC_ISER:
+  case NVIC_ICER:
+    word = enabled;
+    break;
+  case NVIC_ISPR:
+  case NVIC_ICPR:
+    word = pending >> EXC_IRQ0;
+    break;
+  case NVIC_IPR ... NVIC_IPR + 0x1c:
+    word = 0;
+    for (int i = 0; i < 4; ++i)
+      word |= prio[EXC_IRQ0 + (addr - NVIC_IPR) + i] << (i * 8);
+    break;
+  case SCB_CPUID:
+    word = 0x410cc200; // cortex-m0 r0p0
+    break;
+  case SCB_ICSR:
+    word = current | highest_pending() << 12;
+    if (pending >> EXC_IRQ0)
+      word |= 1u << 22;
+    if (pending >> EXC_NMI & 1)
+      word |= ICSR_NMIPENDSET;
+    if (pending >> EXC_PENDSV & 1)
+      word |= ICSR_PENDSVSET;
+    if (pending >> EXC_SYSTICK & 1)
+      word |= ICSR_PENDSTSET;
+    break;
+  case SCB_AIRCR:
+    word = 0xfa050000; // little endian
+    break;
+  case SCB_SCR:
+    word = scr;
+    break;
+  case SCB_CCR:
+    word = 0x208; // stkalign, unalign_trp
+    break;
+  case SCB_SHPR2:
+    word = prio[EXC_SVCALL] << 24;
+    break;
+  case SCB_SHPR3:
+    word = prio[EXC_PENDSV] << 16 | prio[EXC_SYSTICK] << 24;
+    break;
+  default:
+    word = 0;
+  }
+}
@@ -0,0 +1,31 @@
+#include "bus/rtc.hh"
+#include "common.hh"
+
+Rtc::Rtc(CycleSource cycles, uint64_t period)
+    : RegisterDevice(0x8), cycles(cycles), period(period),
+      start(std::chrono::steady_clock::now()) {}
+
+void Rtc::write32(uint32_t &word, size_t addr) {}
+
+void Rtc::read32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case RTC_LO: {
+    uint64_t now = cycles();
+    if (!fresh || now - sampled >= period) {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+               .count();
+      sampled = now;
+      fresh = true;
+    }
+    hi = us >> 32;
+    word = us;
+    break;
+  }
+  case RTC_HI:
+    word = hi;
+    break;
+  default:
+    word = 0;
+  }
+}
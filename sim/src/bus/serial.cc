@@ -1,78 +1,153 @@
+#include <set>
+
 #include "bus/serial.hh"
 #include "common.hh"
 
-Serial::Serial(size_t siz) : Device(siz) {}
+using namespace std::chrono;
 
-void Serial::write(char *buf, size_t addr, size_t len) {
-  for (size_t i = 0; i < len; ++i)
-    putc(buf[i], stdout);
-  fflush(stdout);
+// serials still holding output, exit() skips their destructors
+static std::mutex live_lock;
+static std::set<Serial *> live;
+
+Serial::Serial(size_t siz, FILE *out, bool linebuf, bool flusher)
+    : Device(siz), out(out), linebuf(linebuf) {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    atexit([] {
+      std::lock_guard<std::mutex> guard(live_lock);
+      for (Serial *serial : live)
+        serial->flush();
+    });
+  });
+  {
+    std::lock_guard<std::mutex> guard(live_lock);
+    live.insert(this);
+  }
+  if (flusher)
+    this->flusher = std::thread(&Serial::flush_loop, this);
 }
 
-void Serial::read(char *buf, size_t addr, size_t len) {}
+Serial::~Serial() {
+  {
+    std::lock_guard<std::mutex> guard(live_lock);
+    live.erase(this);
+  }
+  if (flusher.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    kick.notify_one();
+    flusher.join();
+  }
+  flush();
+}
 
-void Serial::write64(uint64_t &dword, size_t addr) {
-  uint8_t buf[sizeof(dword)];
-  buf[0] = (dword >> 0) & 0xFF;
-  buf[1] = (dword >> 8) & 0xFF;
-  buf[2] = (dword >> 16) & 0xFF;
-  buf[3] = (dword >> 24) & 0xFF;
-  buf[4] = (dword >> 32) & 0xFF;
-  buf[5] = (dword >> 40) & 0xFF;
-  buf[6] = (dword >> 48) & 0xFF;
-  buf[7] = (dword >> 56) & 0xFF;
-  write((char *)buf, addr, sizeof(dword));
+void Serial::push(char c) {
+  // the budget starts, the flusher has to time it
+  if (head == tail) {
+    oldest = steady_clock::now();
+    if (flusher.joinable())
+      kick.notify_one();
+  }
+  ring[head++ % SERIAL_RING] = c;
 }
 
-void Serial::read64(uint64_t &dword, size_t addr) {
-  uint8_t buf[sizeof(dword)];
-  read((char *)buf, addr, sizeof(dword));
-  dword = (uint64_t)buf[0];
-  dword |= (uint64_t)buf[1] << 8;
-  dword |= (uint64_t)buf[2] << 16;
-  dword |= (uint64_t)buf[3] << 24;
-  dword |= (uint64_t)buf[4] << 32;
-  dword |= (uint64_t)buf[5] << 40;
-  dword |= (uint64_t)buf[6] << 48;
-  dword |= (uint64_t)buf[7] << 56;
+size_t Serial::take(char *dst) {
+  size_t len = head - tail;
+  size_t from = tail % SERIAL_RING;
+  size_t first = std::min(len, SERIAL_RING - from);
+  memcpy(dst, ring + from, first);
+  memcpy(dst + first, ring, len - first);
+  tail = head;
+  urgent = false;
+  room.notify_all();
+  return len;
 }
 
-void Serial::write32(uint32_t &word, size_t addr) {
-  uint8_t buf[sizeof(word)];
-  buf[0] = (word >> 0) & 0xFF;
-  buf[1] = (word >> 8) & 0xFF;
-  buf[2] = (word >> 16) & 0xFF;
-  buf[3] = (word >> 24) & 0xFF;
-  write((char *)buf, addr, sizeof(word));
+void Serial::emit(const char *buf, size_t len) {
+  if (!len)
+    return;
+  fwrite(buf, 1, len, out);
+  fflush(out);
 }
 
-void Serial::read32(uint32_t &word, size_t addr) {
-  uint8_t buf[sizeof(word)];
-  read((char *)buf, addr, sizeof(word));
-  word = buf[0];
-  word |= buf[1] << 8;
-  word |= buf[2] << 16;
-  word |= buf[3] << 24;
+void Serial::drain() {
+  char chunk[SERIAL_RING];
+  emit(chunk, take(chunk));
 }
 
-void Serial::write16(uint16_t &hword, size_t addr) {
-  uint8_t buf[sizeof(hword)];
-  buf[0] = (hword >> 0) & 0xFF;
-  buf[1] = (hword >> 8) & 0xFF;
-  write((char *)buf, addr, sizeof(hword));
+void Serial::flush_loop() {
+  char chunk[SERIAL_RING];
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (!urgent && !stopping) {
+        if (head == tail)
+          kick.wait(guard);
+        else if (kick.wait_until(guard, oldest + milliseconds(SERIAL_BUDGET_MS)) ==
+                 std::cv_status::timeout)
+          break;
+      }
+      // the destructor writes what is left
+      if (stopping)
+        return;
+    }
+
+    // iolock first, so bytes taken here reach the host before later ones
+    std::lock_guard<std::mutex> io(iolock);
+    size_t len;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      len = take(chunk);
+    }
+    emit(chunk, len);
+  }
 }
 
-void Serial::read16(uint16_t &hword, size_t addr) {
-  uint8_t buf[sizeof(hword)];
-  read((char *)buf, addr, sizeof(hword));
-  hword = buf[0];
-  hword |= buf[1] << 8;
+void Serial::flush_due() {
+  if (flusher.joinable())
+    return;
+  std::lock_guard<std::mutex> guard(lock);
+  if (head != tail &&
+      steady_clock::now() - oldest >= milliseconds(SERIAL_BUDGET_MS)) {
+    drain();
+  }
 }
 
-void Serial::write8(uint8_t &byte, size_t addr) {
-  write((char *)&byte, addr, sizeof(byte));
+void Serial::flush() {
+  std::lock_guard<std::mutex> io(iolock);
+  char chunk[SERIAL_RING];
+  size_t len;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    len = take(chunk);
+  }
+  emit(chunk, len);
 }
 
-void Serial::read8(uint8_t &byte, size_t addr) {
-  read((char *)&byte, addr, sizeof(byte));
-}
\ No newline at end of file
+void Serial::write(char *buf, size_t addr, size_t len) {
+  std::unique_lock<std::mutex> guard(lock);
+  for (size_t i = 0; i < len; ++i) {
+    bool full = head - tail == SERIAL_RING;
+    if (full && flusher.joinable()) {
+      urgent = true;
+      kick.notify_one();
+      room.wait(guard, [this] { return head - tail < SERIAL_RING; });
+    } else if (full) {
+      drain();
+    }
+
+    push(buf[i]);
+    if (!linebuf || buf[i] != '\n')
+      continue;
+    if (flusher.joinable()) {
+      urgent = true;
+      kick.notify_one();
+    } else {
+      drain();
+    }
+  }
+}
+
+void Serial::read(char *buf, size_t addr, size_t len) {}
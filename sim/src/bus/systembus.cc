@@ -1,66 +1,171 @@
 #include "bus/sysbus.hh"
 #include "common.hh"
 
-std::pair<const uint64_t, Device *> &SystemBus::finddev(uint64_t addr) {
+std::pair<const uint64_t, SystemBus::Port> &
+SystemBus::finddev(uint64_t addr) {
   Device *dev = nullptr;
   auto &&iter = iomap.upper_bound(addr);
   if (iter == iomap.begin())
     panic("device not found");
   iter--;
-  if (iter->first <= addr && iter->first + iter->second->size() > addr)
-    dev = iter->second;
+  if (iter->first <= addr && iter->first + iter->second.dev->size() > addr)
+    dev = iter->second.dev;
   panicifnot(dev);
   return *iter;
 }
 
-void SystemBus::regdev(Device *dev, uint64_t addr) { iomap.emplace(addr, dev); }
+SystemBus::SystemBus(bool counting) : counting(counting) {
+  // calloc keeps the untouched parts of the tables off physical memory
+  rpages = (char **)calloc(BUS_NR_PAGES, sizeof(char *));
+  wpages = (char **)calloc(BUS_NR_PAGES, sizeof(char *));
+  panicifnot(rpages && wpages);
+  if (!counting)
+    return;
+  for (int lg = 0; lg < 4; ++lg) {
+    pagereads[lg] = (uint64_t *)calloc(BUS_NR_PAGES, sizeof(uint64_t));
+    pagewrites[lg] = (uint64_t *)calloc(BUS_NR_PAGES, sizeof(uint64_t));
+    panicifnot(pagereads[lg] && pagewrites[lg]);
+  }
+}
+
+SystemBus::~SystemBus() {
+  free(rpages);
+  free(wpages);
+  for (int lg = 0; lg < 4; ++lg) {
+    free(pagereads[lg]);
+    free(pagewrites[lg]);
+  }
+}
+
+void SystemBus::regdev(Device *dev, uint64_t addr, const char *name) {
+  char fallback[32];
+  if (!name) {
+    sprintf(fallback, "dev@0x%08" PRIx64, addr);
+    name = fallback;
+  }
+  char *rbase = dev->direct(false);
+  char *wbase = dev->direct(true);
+  iomap.emplace(addr, Port{dev, name, rbase != nullptr, wbase != nullptr});
+
+  uint64_t first = (addr + BUS_PAGE_MASK) >> BUS_PAGE_SHIFT;
+  uint64_t last = std::min<uint64_t>((addr + dev->size()) >> BUS_PAGE_SHIFT,
+                                     BUS_NR_PAGES);
+  for (uint64_t page = first; page < last; ++page) {
+    uint64_t offset = (page << BUS_PAGE_SHIFT) - addr;
+    rpages[page] = rbase ? rbase + offset : nullptr;
+    wpages[page] = wbase ? wbase + offset : nullptr;
+  }
+}
+
+uint64_t SystemBus::next_event(uint64_t now) {
+  uint64_t next = ~0ull;
+  for (auto &&[addr, port] : iomap)
+    next = std::min(next, port.dev->next_event(now));
+  return next;
+}
+
+void SystemBus::resync() {
+  for (auto &&[addr, port] : iomap)
+    port.dev->resync();
+}
 
 void SystemBus::write(char *buf, size_t addr, size_t len) {
   auto &&dev = finddev(addr);
-  dev.second->write(buf, addr - dev.first, len);
+  dev.second.dev->write(buf, addr - dev.first, len);
 }
 
 void SystemBus::read(char *buf, size_t addr, size_t len) {
   auto &&dev = finddev(addr);
-  dev.second->read(buf, addr - dev.first, len);
+  dev.second.dev->read(buf, addr - dev.first, len);
 }
 
-void SystemBus::write64(uint64_t &dword, size_t addr) {
+void SystemBus::mmio_write64(uint64_t &dword, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->write64(dword, addr - dev.first);
+  dev.second.writes[3] += 1;
+  dev.second.dev->write64(dword, addr - dev.first);
 }
 
-void SystemBus::read64(uint64_t &dword, size_t addr) {
+void SystemBus::mmio_read64(uint64_t &dword, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->read64(dword, addr - dev.first);
+  dev.second.reads[3] += 1;
+  if (!dev.second.rram)
+    ioreads += 1;
+  dev.second.dev->read64(dword, addr - dev.first);
 }
 
-void SystemBus::write32(uint32_t &word, size_t addr) {
+void SystemBus::mmio_write32(uint32_t &word, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->write32(word, addr - dev.first);
+  dev.second.writes[2] += 1;
+  dev.second.dev->write32(word, addr - dev.first);
 }
 
-void SystemBus::read32(uint32_t &word, size_t addr) {
+void SystemBus::mmio_read32(uint32_t &word, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->read32(word, addr - dev.first);
+  dev.second.reads[2] += 1;
+  if (!dev.second.rram)
+    ioreads += 1;
+  dev.second.dev->read32(word, addr - dev.first);
 }
 
-void SystemBus::write16(uint16_t &hword, size_t addr) {
+void SystemBus::mmio_write16(uint16_t &hword, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->write16(hword, addr - dev.first);
+  dev.second.writes[1] += 1;
+  dev.second.dev->write16(hword, addr - dev.first);
 }
 
-void SystemBus::read16(uint16_t &hword, size_t addr) {
+void SystemBus::mmio_read16(uint16_t &hword, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->read16(hword, addr - dev.first);
+  dev.second.reads[1] += 1;
+  if (!dev.second.rram)
+    ioreads += 1;
+  dev.second.dev->read16(hword, addr - dev.first);
 }
 
-void SystemBus::write8(uint8_t &byte, size_t addr) {
+void SystemBus::mmio_write8(uint8_t &byte, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->write8(byte, addr - dev.first);
+  dev.second.writes[0] += 1;
+  dev.second.dev->write8(byte, addr - dev.first);
 }
 
-void SystemBus::read8(uint8_t &byte, size_t addr) {
+void SystemBus::mmio_read8(uint8_t &byte, size_t addr) {
   auto &&dev = finddev(addr);
-  dev.second->read8(byte, addr - dev.first);
-}
\ No newline at end of file
+  dev.second.reads[0] += 1;
+  if (!dev.second.rram)
+    ioreads += 1;
+  dev.second.dev->read8(byte, addr - dev.first);
+}
+
+void SystemBus::dump_counters(FILE *fp) const {
+  uint64_t ram = 0, mmio = 0;
+  fprintf(fp, "{\n    \"ports\": {");
+  const char *sep = "\n";
+  for (auto &&[addr, port] : iomap) {
+    fprintf(fp, "%s      \"%s\": {\"base\": %" PRIu64 ", \"kind\": \"%s\"",
+            sep, port.name.c_str(), addr,
+            port.rram && port.wram ? "ram" : "mmio");
+    // the pages regdev gave this port in the page tables
+    uint64_t first = (addr + BUS_PAGE_MASK) >> BUS_PAGE_SHIFT;
+    uint64_t last = std::min<uint64_t>(
+        (addr + port.dev->size()) >> BUS_PAGE_SHIFT, BUS_NR_PAGES);
+    // a direction counts as ram when it bypasses the device
+    for (auto &&[key, counts, pages, direct] :
+         {std::tuple{"reads", port.reads, pagereads, port.rram},
+          std::tuple{"writes", port.writes, pagewrites, port.wram}}) {
+      fprintf(fp, ", \"%s\": {", key);
+      for (int lg = 0; lg < 4; ++lg) {
+        uint64_t n = counts[lg];
+        for (uint64_t page = first; counting && page < last; ++page)
+          n += pages[lg][page];
+        fprintf(fp, "%s\"%d\": %" PRIu64, lg ? ", " : "", 1 << lg, n);
+        (direct ? ram : mmio) += n;
+      }
+      fprintf(fp, "}");
+    }
+    fprintf(fp, "}");
+    sep = ",\n";
+  }
+  fprintf(fp, "\n    },\n");
+  fprintf(fp, "    \"counted\": %s,\n", counting ? "true" : "false");
+  fprintf(fp, "    \"ram\": %" PRIu64 ",\n", ram);
+  fprintf(fp, "    \"mmio\": %" PRIu64 "\n  }", mmio);
+}
@@ -0,0 +1,99 @@
+#include "bus/systick.hh"
+#include "common.hh"
+
+SysTick::SysTick(CycleSource cycles, Nvic *nvic)
+    : RegisterDevice(0x10), cycles(cycles), nvic(nvic) {
+  if (nvic)
+    nvic->attach(this);
+}
+
+// the counter runs cvr down to 0, reloads rvr on the following cycle and
+// so on, COUNTFLAG and the exception come every time it steps from 1 to 0
+void SysTick::latch() {
+  uint64_t now = cycles();
+  uint64_t elapsed = now - base;
+  base = now;
+  if (!(csr & SYST_CSR_ENABLE) || !elapsed)
+    return;
+
+  bool wrapped;
+  if (elapsed <= cvr) {
+    cvr -= elapsed;
+    wrapped = cvr == 0;
+  } else if (!rvr) {
+    // a reload value of 0 stops the counter at 0
+    wrapped = cvr != 0;
+    cvr = 0;
+  } else {
+    uint64_t reloaded = elapsed - cvr - 1;
+    wrapped = cvr != 0 || reloaded >= rvr;
+    cvr = rvr - reloaded % ((uint64_t)rvr + 1);
+  }
+  countflag |= wrapped;
+  fired |= wrapped;
+}
+
+// the next step from 1 to 0, where COUNTFLAG goes up
+uint64_t SysTick::next_event(uint64_t now) {
+  latch();
+  if (!(csr & SYST_CSR_ENABLE))
+    return ~0ull;
+  if (cvr)
+    return now + cvr;
+  return rvr ? now + 1 + rvr : ~0ull;
+}
+
+void SysTick::poll() {
+  latch();
+  if (fired && (csr & SYST_CSR_TICKINT))
+    nvic->pend(EXC_SYSTICK);
+  fired = false;
+}
+
+uint64_t SysTick::deadline() {
+  if (!(csr & SYST_CSR_TICKINT))
+    return ~0ull;
+  return next_event(cycles());
+}
+
+void SysTick::write32(uint32_t &word, size_t addr) {
+  latch();
+  switch (addr) {
+  case SYST_CSR:
+    csr = word & (SYST_CSR_ENABLE | SYST_CSR_TICKINT | SYST_CSR_CLKSOURCE);
+    break;
+  case SYST_RVR:
+    rvr = word & Mask32<23, 0>;
+    break;
+  case SYST_CVR:
+    // any write clears the counter
+    cvr = 0;
+    countflag = false;
+    break;
+  }
+  // tickint or the period may have changed
+  if (nvic)
+    nvic->changed();
+}
+
+void SysTick::read32(uint32_t &word, size_t addr) {
+  latch();
+  switch (addr) {
+  case SYST_CSR:
+    word = csr | (countflag ? SYST_CSR_COUNTFLAG : 0);
+    countflag = false;
+    break;
+  case SYST_RVR:
+    word = rvr;
+    break;
+  case SYST_CVR:
+    word = cvr;
+    break;
+  case SYST_CALIB:
+    // no reference clock, TENMS is exact
+    word = 1u << 31 | (CPU_HZ / 100 - 1);
+    break;
+  default:
+    word = 0;
+  }
+}
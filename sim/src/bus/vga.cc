@@ -0,0 +1,321 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <set>
+
+#include "bus/vga.hh"
+#include "common.hh"
+
+//
+// ----- ----- Framebuffer ----- -----
+//
+
+Framebuffer::Framebuffer(uint32_t width, uint32_t height)
+    : Device((size_t)width * height * 4), width(width), height(height),
+      mem(devsiz), spans(height, Span{width, 0}), top(height), bottom(0) {}
+
+void Framebuffer::out_of_range() { panic("framebuffer access out of range"); }
+
+void Framebuffer::mark(size_t addr, size_t len) {
+  size_t pitch = (size_t)width * 4;
+  for (size_t end = addr + len; addr < end;) {
+    uint32_t row = addr / pitch;
+    size_t stop = std::min(end, (row + 1) * pitch);
+    Span &span = spans[row];
+    span.lo = std::min<uint32_t>(span.lo, addr % pitch / 4);
+    span.hi = std::max<uint32_t>(span.hi, (stop - 1) % pitch / 4 + 1);
+    top = std::min(top, row);
+    bottom = std::max(bottom, row + 1);
+    addr = stop;
+  }
+}
+
+std::vector<Rect> Framebuffer::collect() {
+  std::vector<Rect> dirty;
+  for (uint32_t y = top; y < bottom; ++y) {
+    Span &span = spans[y];
+    if (span.lo >= span.hi)
+      continue;
+
+    Rect *last = dirty.empty() ? nullptr : &dirty.back();
+    if (last && last->y + last->h == y) {
+      uint32_t x1 = std::max(last->x + last->w, span.hi);
+      last->x = std::min(last->x, span.lo);
+      last->w = x1 - last->x;
+      last->h += 1;
+    } else {
+      dirty.push_back(Rect{span.lo, y, span.hi - span.lo, 1});
+    }
+    span = Span{width, 0};
+  }
+  top = height;
+  bottom = 0;
+  return dirty;
+}
+
+// stores have to be seen to be tracked
+char *Framebuffer::direct(bool write) { return write ? nullptr : mem.data(); }
+
+void Framebuffer::write(char *buf, size_t addr, size_t len) {
+  if (addr + len > devsiz)
+    out_of_range();
+  memcpy(mem.data() + addr, buf, len);
+  mark(addr, len);
+}
+
+void Framebuffer::read(char *buf, size_t addr, size_t len) {
+  if (addr + len > devsiz)
+    out_of_range();
+  memcpy(buf, mem.data() + addr, len);
+}
+
+//
+// ----- ----- Vga ----- -----
+//
+
+Vga::Vga(Framebuffer *fb) : RegisterDevice(0x8), fb(fb) {}
+
+void Vga::write32(uint32_t &word, size_t addr) {
+  if (addr != VGA_CTL_SYNC || !word)
+    return;
+
+  frames += 1;
+  std::vector<Rect> dirty = fb->collect();
+  for (FrameSink *sink : sinks)
+    sink->frame(fb->pixels(), fb->w(), fb->h(), dirty);
+}
+
+void Vga::read32(uint32_t &word, size_t addr) {
+  switch (addr) {
+  case VGA_CTL_SIZE:
+    word = fb->w() << 16 | fb->h();
+    break;
+  default:
+    word = 0;
+  }
+}
+
+//
+// ----- ----- Encoding ----- -----
+//
+
+static void put_be32(std::vector<Bytef> &out, uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back(v >> shift);
+}
+
+static void put_chunk(FILE *fp, const char *type, const std::vector<Bytef> &data) {
+  std::vector<Bytef> head;
+  put_be32(head, data.size());
+  head.insert(head.end(), type, type + 4);
+  uLong crc = crc32(0, head.data() + 4, 4);
+  // a null buffer asks crc32 for its initial value
+  if (!data.empty())
+    crc = crc32(crc, data.data(), data.size());
+  std::vector<Bytef> tail;
+  put_be32(tail, crc);
+
+  fwrite(head.data(), 1, head.size(), fp);
+  fwrite(data.data(), 1, data.size(), fp);
+  fwrite(tail.data(), 1, tail.size(), fp);
+}
+
+// 8-bit rgb, no interlace, every row unfiltered. False when @path can not be
+// written.
+static bool write_png(const std::string &path, uint32_t width, uint32_t height,
+                      const std::vector<char> &rgb) {
+  size_t pitch = (size_t)width * 3;
+  std::vector<Bytef> rows;
+  rows.reserve((pitch + 1) * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    rows.push_back(0);
+    rows.insert(rows.end(), rgb.begin() + y * pitch,
+                rgb.begin() + (y + 1) * pitch);
+  }
+
+  uLongf complen = compressBound(rows.size());
+  std::vector<Bytef> idat(complen);
+  panicifnot(compress2(idat.data(), &complen, rows.data(), rows.size(),
+                       Z_BEST_SPEED) == Z_OK);
+  idat.resize(complen);
+
+  std::vector<Bytef> ihdr;
+  put_be32(ihdr, width);
+  put_be32(ihdr, height);
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp)
+    return false;
+  fwrite("\x89PNG\r\n\x1a\n", 1, 8, fp);
+  put_chunk(fp, "IHDR", ihdr);
+  put_chunk(fp, "IDAT", idat);
+  put_chunk(fp, "IEND", {});
+  return fclose(fp) == 0;
+}
+
+// @rect of the screen into rgb bytes, @rgb is the whole screen too
+static void blit_rgb(const char *pixels, uint32_t width, const Rect &rect,
+                     char *rgb) {
+  for (uint32_t y = rect.y; y < rect.y + rect.h; ++y) {
+    const char *src = pixels + ((size_t)y * width + rect.x) * 4;
+    char *dst = rgb + ((size_t)y * width + rect.x) * 3;
+    for (uint32_t x = 0; x < rect.w; ++x, src += 4, dst += 3) {
+      uint32_t px = load_le<uint32_t>(src);
+      dst[0] = px >> 16;
+      dst[1] = px >> 8;
+      dst[2] = px;
+    }
+  }
+}
+
+//
+// ----- ----- PpmSink ----- -----
+//
+
+PpmSink::PpmSink(const char *path, uint32_t width, uint32_t height)
+    : width(width), height(height) {
+  char header[32];
+  int len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+  mapsiz = len + (size_t)width * height * 3;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    panic("can not open screen output");
+  panicifnot(ftruncate(fd, mapsiz) == 0);
+  void *p = mmap(nullptr, mapsiz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  panicifnot(p != MAP_FAILED);
+
+  map = (char *)p;
+  memcpy(map, header, len);
+  rgb = map + len;
+}
+
+PpmSink::~PpmSink() { munmap(map, mapsiz); }
+
+void PpmSink::frame(const char *pixels, uint32_t width, uint32_t height,
+                    const std::vector<Rect> &dirty) {
+  panicifnot(width == this->width && height == this->height);
+  for (const Rect &rect : dirty)
+    blit_rgb(pixels, width, rect, rgb);
+}
+
+//
+// ----- ----- PngSink ----- -----
+//
+
+// sinks not finished yet, exit() skips the run's finish
+static std::mutex unfinished_lock;
+static std::set<PngSink *> unfinished;
+
+PngSink::PngSink(const char *path, uint32_t width, uint32_t height)
+    : path(path), width(width), height(height),
+      shadow((size_t)width * height * 3) {
+  // fail now rather than at the end of the run
+  FILE *fp = fopen(path, "wb");
+  if (!fp)
+    panic("can not open screen output");
+  fclose(fp);
+
+  static std::once_flag once;
+  std::call_once(once, [] {
+    atexit([] {
+      std::lock_guard<std::mutex> guard(unfinished_lock);
+      for (PngSink *png : unfinished)
+        write_png(png->path, png->width, png->height, png->shadow);
+    });
+  });
+  std::lock_guard<std::mutex> guard(unfinished_lock);
+  unfinished.insert(this);
+}
+
+PngSink::~PngSink() {
+  std::lock_guard<std::mutex> guard(unfinished_lock);
+  unfinished.erase(this);
+}
+
+bool PngSink::finish() {
+  {
+    std::lock_guard<std::mutex> guard(unfinished_lock);
+    unfinished.erase(this);
+  }
+  return write_png(path, width, height, shadow);
+}
+
+void PngSink::frame(const char *pixels, uint32_t width, uint32_t height,
+                    const std::vector<Rect> &dirty) {
+  panicifnot(width == this->width && height == this->height);
+  for (const Rect &rect : dirty)
+    blit_rgb(pixels, width, rect, shadow.data());
+}
+
+//
+// ----- ----- CaptureSink ----- -----
+//
+
+CaptureSink::CaptureSink(const char *dir, uint32_t width, uint32_t height,
+                         uint64_t limit)
+    : dir(dir), width(width), height(height), limit(limit),
+      shadow((size_t)width * height * 3),
+      pool(CAPTURE_NR_FRAMES, std::vector<char>(shadow.size())) {
+  if (mkdir(dir, 0755) && errno != EEXIST)
+    panic("can not create the capture directory");
+  for (auto &&buf : pool)
+    spare.push_back(&buf);
+  writer = std::thread(&CaptureSink::drain, this);
+}
+
+CaptureSink::~CaptureSink() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+  }
+  ready.notify_one();
+  writer.join();
+}
+
+void CaptureSink::frame(const char *pixels, uint32_t width, uint32_t height,
+                        const std::vector<Rect> &dirty) {
+  panicifnot(width == this->width && height == this->height);
+  if (limit && captured >= limit)
+    return;
+  for (const Rect &rect : dirty)
+    blit_rgb(pixels, width, rect, shadow.data());
+
+  std::unique_lock<std::mutex> guard(lock);
+  if (spare.empty()) {
+    stalls += 1;
+    freed.wait(guard, [this] { return !spare.empty(); });
+  }
+  std::vector<char> *buf = spare.back();
+  spare.pop_back();
+  memcpy(buf->data(), shadow.data(), shadow.size());
+  full.emplace_back(captured++, buf);
+  ready.notify_one();
+}
+
+void CaptureSink::drain() {
+  for (;;) {
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait(guard, [this] { return done || !full.empty(); });
+    // the core queues its last frame before raising done
+    if (full.empty())
+      break;
+    auto [seq, buf] = full.front();
+    full.pop_front();
+    guard.unlock();
+
+    char name[64];
+    snprintf(name, sizeof(name), "/frame-%06" PRIu64 ".png", seq);
+    if (!write_png(dir + name, width, height, *buf))
+      panic("can not write a captured frame");
+
+    guard.lock();
+    spare.push_back(buf);
+    freed.notify_one();
+  }
+}
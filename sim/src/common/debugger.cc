@@ -1,49 +1,61 @@
 #include "debug/debugger.hh"
 #include "common.hh"
 
+// the debugger of the core running on this thread, dumped by exit()
+static thread_local Debugger32 *postmortem = nullptr;
+
+volatile sig_atomic_t Debugger32::interrupted = 0;
+
 Debugger32::Debugger32() {}
 
+// a run that ends normally leaves the rings alone, only exit() dumps them
 Debugger32::~Debugger32() {
-  pallmsg();
+  if (postmortem == this)
+    postmortem = nullptr;
 }
 
-void Debugger32::pushreg(std::string msg) {
-  regque.push_back(msg);
-  if (regque.size() > 4)
-    regque.pop_front();
+void Debugger32::pushreg(const uint32_t *before, const uint32_t *after) {
+  RegRecord &rec = regque.push();
+  memcpy(rec.before, before, sizeof(rec.before));
+  memcpy(rec.after, after, sizeof(rec.after));
 }
 
-void Debugger32::pushjmp(uint32_t addr) {
-  char buf[128] = {0};
-  sprintf(buf, "[%08x] b <%08x>", curaddr, addr);
-  jmpque.push_back(buf);
-  if (jmpque.size() > maxlen)
-    jmpque.pop_front();
-}
+void Debugger32::pushjmp(uint32_t addr) { jmpque.push() = {curaddr, addr}; }
 
-void Debugger32::pushinst(uint32_t inst) {
-  char buf[128] = {0};
-
-  sprintf(buf, "[%08x] %08x", curaddr, inst);
-  instque.push_back(buf);
-  if (instque.size() > maxlen)
-    instque.pop_front();
-}
+void Debugger32::pushinst(uint32_t inst) { instque.push() = {curaddr, inst}; }
 
 void Debugger32::pushmem(uint32_t addr, uint32_t data, bool memi) {
-  char buf[128] = {0};
-  sprintf(buf, "[%08x] %c @%08x %08x", curaddr, (memi ? 'r' : 'w'), addr, data);
-  memque.push_back(buf);
-  if (memque.size() > maxlen)
-    memque.pop_front();
+  memque.push() = {curaddr, addr, data, memi};
 }
 
 void Debugger32::setaddr(uint32_t addr) { curaddr = addr; }
 
-void Debugger32::setqlen(uint32_t len) { maxlen = len; }
+void Debugger32::setqlen(uint32_t len) {
+  panicifnot(len > 0);
+  memque.resize(len);
+  instque.resize(len);
+  jmpque.resize(len);
+  regque.resize(4);
+}
+
+void Debugger32::arm() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    atexit([] {
+      if (postmortem)
+        postmortem->pallmsg();
+    });
+  });
+  postmortem = this;
+}
+
+void Debugger32::catch_interrupt() {
+  signal(SIGINT, [](int) { interrupted = 1; });
+}
 
 void Debugger32::getopt() {
-  static uint32_t pass = 0;
+  interrupted = 0;
+  stepping = true;
   if (pass) {
     pass -= 1;
     return;
@@ -53,7 +65,11 @@ void Debugger32::getopt() {
 
   do {
     printf("(dbg) ");
-    fgets(buf, 128, stdin);
+    // nobody to ask, run on
+    if (!fgets(buf, 128, stdin)) {
+      stepping = false;
+      break;
+    }
 
     if (*buf == 'q')
       exit(EXIT_SUCCESS);
@@ -70,28 +86,52 @@ void Debugger32::getopt() {
       pass = skip;
       break;
     }
+
+    else if (*buf == 'c') {
+      stepping = false;
+      break;
+    }
   } while (false);
 }
 
 void Debugger32::pallmsg() {
   std::cout << "Register Trace Info:" << std::endl;
-  for (auto &&msg : regque) {
+  for (size_t i = 0; i < regque.size(); ++i) {
+    const RegRecord &rec = regque[i];
+    char buf[64];
     std::cout << std::endl;
-    std::cout << msg << std::endl;
+    for (int r = 0; r < 16; ++r) {
+      static const char *const names[] = {"SP ", "LR ", "PC "};
+      char name[4];
+      if (r < 13)
+        sprintf(name, "R%02d", r);
+      else
+        strcpy(name, names[r - 13]);
+      sprintf(buf, "%s: %08x => %08x", name, rec.before[r], rec.after[r]);
+      std::cout << buf << std::endl;
+    }
   }
   std::cout << std::endl;
   std::cout << "Instruction Trace Info:" << std::endl;
-  for (auto &&msg : instque) {
-    std::cout << "\t" << msg << std::endl;
+  for (size_t i = 0; i < instque.size(); ++i) {
+    char buf[64];
+    sprintf(buf, "[%08x] %08x", instque[i].addr, instque[i].inst);
+    std::cout << "\t" << buf << std::endl;
   }
   std::cout << std::endl;
   std::cout << "Memory Trace Info:" << std::endl;
-  for (auto &&msg : memque) {
-    std::cout << "\t" << msg << std::endl;
+  for (size_t i = 0; i < memque.size(); ++i) {
+    const MemRecord &rec = memque[i];
+    char buf[64];
+    sprintf(buf, "[%08x] %c @%08x %08x", rec.pc, (rec.read ? 'r' : 'w'),
+            rec.addr, rec.data);
+    std::cout << "\t" << buf << std::endl;
   }
   std::cout << std::endl;
   std::cout << "JMP Trace Info:" << std::endl;
-  for (auto &&msg : jmpque) {
-    std::cout << "\t" << msg << std::endl;
+  for (size_t i = 0; i < jmpque.size(); ++i) {
+    char buf[64];
+    sprintf(buf, "[%08x] b <%08x>", jmpque[i].pc, jmpque[i].target);
+    std::cout << "\t" << buf << std::endl;
   }
-}
\ No newline at end of file
+}
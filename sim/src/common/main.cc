@@ -1,34 +1,501 @@
 #include <stdio.h>
+#include <getopt.h>
+#include <signal.h>
 
 #include "xdef.hh"
 #include "common.hh"
 
-int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    std::cout << "Usage: sim <bin>";
-    return 0;
+#define STEP_QUANTUM (1 << 20)
+#define MAX_JOBS 1024 // batch worker threads
+
+thread_local bool panic_throws = false;
+
+struct Options {
+  CpuOptions cpu;
+  uint64_t maxinsts = 0;          // 0 runs until the guest halts
+  uint64_t rtcperiod = 10000;     // guest cycles between host clock reads
+  const char *counters = nullptr; // performance counters go here as JSON
+  const char *serialout = nullptr; // serial output goes here, not stdout
+  bool serialthread = false;       // host writes of serial output off the core
+  const char *screen = nullptr;    // the screen as a PPM, or a PNG at exit
+  bool headless = false;           // report the frame rate at the end
+  uint64_t frames = 0;             // stop after this many frames, 0 never
+  const char *dumpdir = nullptr;   // every frame goes here as a PNG
+  std::vector<KeyEvent> keys;      // replayed on the keyboard
+  const char *audioout = nullptr;  // played samples go here as a WAV
+};
+
+// Host time and guest cycles at each sync, for the frame rate report. Only
+// the first @limit frames count, the run loop stops between quanta.
+struct FrameClock : FrameSink {
+  using clock = std::chrono::steady_clock;
+
+  CycleSource cycles;
+  uint64_t limit;
+  uint64_t frames = 0;
+  clock::time_point first, last;
+  uint64_t firstcycle = 0, lastcycle = 0;
+
+  FrameClock(CycleSource cycles, uint64_t limit)
+      : cycles(cycles), limit(limit) {}
+
+  void frame(const char *, uint32_t, uint32_t, const std::vector<Rect> &) {
+    if (limit && frames >= limit)
+      return;
+    last = clock::now();
+    lastcycle = cycles();
+    if (!frames++) {
+      first = last;
+      firstcycle = lastcycle;
+    }
   }
 
-  SystemBus bus;
+  // rates over the frames after the first, which includes booting
+  void report(clock::time_point start) const {
+    std::chrono::duration<double> boot = first - start, run = last - first;
+    double guest = (double)(lastcycle - firstcycle) / CPU_HZ;
+    fprintf(stderr, "frames: %" PRIu64 "\n", frames);
+    if (!frames)
+      return;
+    fprintf(stderr, "first frame: %.3f s host, %.3f s guest\n", boot.count(),
+            (double)firstcycle / CPU_HZ);
+    if (frames < 2)
+      return;
+    uint64_t n = frames - 1;
+    fprintf(stderr, "host: %.3f s, %.2f frames/s, %.3f ms/frame\n",
+            run.count(), n / run.count(), run.count() * 1e3 / n);
+    fprintf(stderr, "guest: %.3f s, %.2f frames/s\n", guest, n / guest);
+  }
+};
+
+// set by SIGUSR1, the run loop dumps the counters between quanta
+static volatile sig_atomic_t dump_requested = 0;
+
+static void request_dump(int) { dump_requested = 1; }
+
+// written aside and renamed so readers never see half a file
+static void dump_counters(const char *path, Gcpu *cpu, const SystemBus &bus,
+                          uint64_t insts, double seconds) {
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (!fp)
+    panic("can not open counters output");
+
+  double guest_seconds = (double)cpu->Cycles() / CPU_HZ;
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"host_ns\": %.0f,\n", seconds * 1e9);
+  fprintf(fp, "  \"guest_insts\": %" PRIu64 ",\n", insts);
+  fprintf(fp, "  \"guest_hz\": %u,\n", CPU_HZ);
+  fprintf(fp, "  \"host_ns_per_guest_sec\": %.0f,\n",
+          guest_seconds > 0 ? seconds * 1e9 / guest_seconds : 0.0);
+  fprintf(fp, "  \"cpu\": ");
+  cpu->DumpCounters(fp);
+  fprintf(fp, ",\n  \"bus\": ");
+  bus.dump_counters(fp);
+  fprintf(fp, "\n}\n");
+  fclose(fp);
+
+  if (rename(tmp.c_str(), path))
+    panic("can not write counters output");
+}
+
+struct Outcome {
+  bool opened = false;
+  bool halted = false;
+  bool framed = false; // stopped after --frames frames, not a timeout
+  uint32_t exitcode = 0;
+  uint64_t insts = 0;
+  double seconds = 0;
+  std::string panic; // why the simulator gave up on the image
+};
+
+// one board per call, serial output goes to @serial, a line at a time if
+// @linebuf. @res is filled as the run goes, a panic leaves what it got to.
+static void run_image(const char *image, const Options &opts, FILE *serial,
+                      bool linebuf, Outcome &res) {
+  if (!std::ifstream(image))
+    return;
+  res.opened = true;
+
+  SystemBus bus(opts.counters != nullptr);
   Memory ram(2 * 1024 * 1024);
   Memory stk(256 * 1024);
 
-  Memory flash(1024 * 1024);
-  flash.load(argv[1]);
+  // flash is a read-only view of the file, ram maps it copy-on-write
+  Memory flash(1024 * 1024, false);
+  flash.load(image);
   ram.load(&flash, IMG_ADDR, flash.size());
 
-  bus.regdev(&ram,  RAM_ADDR);
-  bus.regdev(&stk,  STK_ADDR);
+  bus.regdev(&ram,  RAM_ADDR,    "ram");
+  bus.regdev(&stk,  STK_ADDR,    "stk");
+
+  Serial bios(1, serial, linebuf, opts.serialthread);
+  bus.regdev(&bios, SERIAL_PORT, "serial");
+
+  // the timers count the core's cycles, they are not read before it exists
+  Gcpu *cpu = nullptr;
+  CycleSource cycles = [&cpu] { return cpu->Cycles(); };
+  Nvic nvic;
+  SysTick systick(cycles, &nvic);
+  Dwt dwt(cycles);
+  bus.regdev(&systick, SYSTICK_ADDR, "systick");
+  bus.regdev(&dwt,     DWT_ADDR,     "dwt");
+  bus.regdev(&nvic,    NVIC_ADDR,    "nvic");
+
+  Rtc rtc(cycles, opts.rtcperiod);
+  bus.regdev(&rtc,     RTC_ADDR,     "rtc");
+
+  Keyboard kbd(cycles, &nvic, KBD_IRQ, opts.keys);
+  bus.regdev(&kbd,     KBD_ADDR,     "kbd");
+
+  // without a file the samples are played into nothing, at the same pace
+  std::unique_ptr<WavWriter> wav;
+  if (opts.audioout)
+    wav = std::make_unique<WavWriter>(opts.audioout);
+  Memory sbuf(AUDIO_SBUF_BYTES);
+  Audio audio(cycles, &nvic, AUDIO_IRQ, &sbuf, wav.get());
+  bus.regdev(&audio,   AUDIO_ADDR,      "audio");
+  bus.regdev(&sbuf,    AUDIO_SBUF_ADDR, "sbuf");
 
-  Serial bios(1);
-  bus.regdev(&bios, SERIAL_PORT);
+  Framebuffer fb(VGA_WIDTH, VGA_HEIGHT);
+  Vga vga(&fb);
+  bus.regdev(&vga, VGACTL_ADDR, "vga");
+  bus.regdev(&fb,  FB_ADDR,     "fb");
 
-  Gcpu *cpu = new Cortex_M0(&bus);
+  // a .png is written once at the end, anything else is the live PPM
+  std::unique_ptr<FrameSink> screen;
+  PngSink *png = nullptr;
+  if (opts.screen) {
+    size_t len = strlen(opts.screen);
+    if (len >= 4 && !strcmp(opts.screen + len - 4, ".png")) {
+      auto sink = std::make_unique<PngSink>(opts.screen, fb.w(), fb.h());
+      png = sink.get();
+      screen = std::move(sink);
+    } else
+      screen = std::make_unique<PpmSink>(opts.screen, fb.w(), fb.h());
+    vga.attach(screen.get());
+  }
+  std::unique_ptr<CaptureSink> capture;
+  if (opts.dumpdir) {
+    capture = std::make_unique<CaptureSink>(opts.dumpdir, fb.w(), fb.h(),
+                                            opts.frames);
+    vga.attach(capture.get());
+  }
+  FrameClock frameclock(cycles, opts.frames);
+  if (opts.headless)
+    vga.attach(&frameclock);
+
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&] {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+  };
+
+  std::unique_ptr<Gcpu> core(new Cortex_M0(&bus, &nvic, opts.cpu));
+  cpu = core.get();
 
-  while (true) {
-    cpu->Step(1);
+  while (!cpu->Halted()) {
+    uint64_t quantum = STEP_QUANTUM;
+    if (opts.maxinsts) {
+      if (res.insts >= opts.maxinsts)
+        break;
+      quantum = std::min(quantum, opts.maxinsts - res.insts);
+    }
+    if (opts.frames && vga.synced() >= opts.frames)
+      break;
+    try {
+      res.insts += cpu->Step(quantum);
+    } catch (const Panic &) {
+      // insts stays at the last whole quantum
+      res.seconds = elapsed();
+      throw;
+    }
+    bios.flush_due();
+    if (opts.counters && dump_requested) {
+      dump_requested = 0;
+      dump_counters(opts.counters, cpu, bus, res.insts, elapsed());
+    }
   }
 
-  delete cpu;
-  return 0;
-}
\ No newline at end of file
+  res.halted = cpu->Halted();
+  res.framed = opts.frames && vga.synced() >= opts.frames;
+  res.exitcode = cpu->ExitCode();
+  res.seconds = elapsed();
+  if (opts.counters)
+    dump_counters(opts.counters, cpu, bus, res.insts, res.seconds);
+  if (opts.headless)
+    frameclock.report(start);
+  if (capture && capture->stalled())
+    fprintf(stderr, "frame writer fell behind %" PRIu64 " times\n",
+            capture->stalled());
+  if (png && !png->finish())
+    res.panic = "can not write screen output";
+}
+
+//
+// ----- ----- Batch ----- -----
+//
+
+static int run_batch(const char *list, unsigned jobs, const Options &opts) {
+  std::ifstream ifs(list);
+  if (!ifs) {
+    std::cerr << "can not open " << list << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // one image per line, blank lines and # comments are skipped
+  std::vector<std::string> images;
+  for (std::string line; std::getline(ifs, line);) {
+    line.erase(0, line.find_first_not_of(" \t"));
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (!line.empty() && line[0] != '#')
+      images.push_back(line);
+  }
+
+  std::vector<Outcome> outcomes(images.size());
+  std::vector<std::string> serials(images.size());
+  std::atomic<size_t> next{0};
+
+  auto worker = [&] {
+    panic_throws = true;
+    for (size_t i; (i = next++) < images.size();) {
+      char *buf = nullptr;
+      size_t len = 0;
+      FILE *out = open_memstream(&buf, &len);
+      panicifnot(out);
+      try {
+        run_image(images[i].c_str(), opts, out, false, outcomes[i]);
+      } catch (const Panic &e) {
+        outcomes[i].panic = e.what();
+      }
+      fclose(out);
+      serials[i].assign(buf, len);
+      free(buf);
+    }
+  };
+
+  // no more workers than images, but one even if the host count is unknown
+  std::vector<std::thread> pool;
+  size_t workers = std::min<size_t>(std::max(jobs, 1u), images.size());
+  for (size_t j = 0; j < workers; ++j)
+    pool.emplace_back(worker);
+  for (auto &&t : pool)
+    t.join();
+
+  size_t passed = 0;
+  for (size_t i = 0; i < images.size(); ++i) {
+    const Outcome &res = outcomes[i];
+    printf("== %s\n", images[i].c_str());
+    if (!res.opened)
+      printf("status: can not open\n");
+    else if (!res.panic.empty())
+      printf("status: panic: %s\n", res.panic.c_str());
+    else if (!res.halted)
+      printf("status: timeout\n");
+    else
+      printf("status: exit %u\n", res.exitcode);
+    printf("insts: %" PRIu64 "\n", res.insts);
+    printf("time: %.3f s\n", res.seconds);
+    printf("--- serial\n%s", serials[i].c_str());
+    if (!serials[i].empty() && serials[i].back() != '\n')
+      printf("\n");
+    printf("\n");
+
+    passed += res.panic.empty() && res.halted && res.exitcode == 0;
+  }
+  printf("%zu images, %zu passed, %zu failed\n", images.size(), passed,
+         images.size() - passed);
+
+  return passed == images.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void usage() {
+  std::cout << "Usage: sim [--jit] [--trace] [--trace-file F] [--max-insts N]"
+            << std::endl
+            << "           [--cpi N] [--rtc-period N] [--no-idle-skip]"
+            << std::endl
+            << "           [--counters F] [--serial-out F] [--serial-thread]"
+            << std::endl
+            << "           [--screen F] [--headless [--frames N] [--dump-dir D]]"
+            << std::endl
+            << "           [--keys F] [--audio-out F]" << std::endl
+            << "           [--profile ELF [--profile-period N] [--profile-out P]]"
+            << std::endl
+            << "           <bin>" << std::endl
+            << "       sim [--jit] [--max-insts N] --batch <list> [-j N]"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  Options opts;
+  const char *batch = nullptr;
+  unsigned jobs = std::thread::hardware_concurrency();
+
+  static const struct option options[] = {
+    {"jit",            no_argument,       nullptr, 'J'},
+    {"trace",          no_argument,       nullptr, 'T'},
+    {"trace-file",     required_argument, nullptr, 'F'},
+    {"profile",        required_argument, nullptr, 'P'},
+    {"profile-period", required_argument, nullptr, 'p'},
+    {"profile-out",    required_argument, nullptr, 'o'},
+    {"max-insts",      required_argument, nullptr, 'm'},
+    {"cpi",            required_argument, nullptr, 'C'},
+    {"rtc-period",     required_argument, nullptr, 'R'},
+    {"no-idle-skip",   no_argument,       nullptr, 'I'},
+    {"counters",       required_argument, nullptr, 'c'},
+    {"serial-out",     required_argument, nullptr, 's'},
+    {"serial-thread",  no_argument,       nullptr, 'S'},
+    {"screen",         required_argument, nullptr, 'v'},
+    {"headless",       no_argument,       nullptr, 'H'},
+    {"frames",         required_argument, nullptr, 'f'},
+    {"dump-dir",       required_argument, nullptr, 'd'},
+    {"keys",           required_argument, nullptr, 'k'},
+    {"audio-out",      required_argument, nullptr, 'a'},
+    {"batch",          required_argument, nullptr, 'b'},
+    {"jobs",           required_argument, nullptr, 'j'},
+    {"help",           no_argument,       nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:h", options, nullptr)) != -1) {
+    switch (opt) {
+    case 'J':
+      opts.cpu.jit = true;
+      break;
+    case 'T':
+      opts.cpu.trace = true;
+      break;
+    case 'F':
+      opts.cpu.tracefile = optarg;
+      break;
+    case 'P':
+      opts.cpu.profelf = optarg;
+      break;
+    case 'p':
+      opts.cpu.profperiod = strtoull(optarg, nullptr, 0);
+      break;
+    case 'o':
+      opts.cpu.profout = optarg;
+      break;
+    case 'm':
+      opts.maxinsts = strtoull(optarg, nullptr, 0);
+      break;
+    case 'C':
+      opts.cpu.cpi = strtoul(optarg, nullptr, 0);
+      break;
+    case 'R':
+      opts.rtcperiod = strtoull(optarg, nullptr, 0);
+      break;
+    case 'I':
+      opts.cpu.idleskip = false;
+      break;
+    case 'c':
+      opts.counters = optarg;
+      break;
+    case 's':
+      opts.serialout = optarg;
+      break;
+    case 'S':
+      opts.serialthread = true;
+      break;
+    case 'v':
+      opts.screen = optarg;
+      break;
+    case 'H':
+      opts.headless = true;
+      break;
+    case 'f':
+      opts.frames = strtoull(optarg, nullptr, 0);
+      break;
+    case 'd':
+      opts.dumpdir = optarg;
+      break;
+    case 'a':
+      opts.audioout = optarg;
+      break;
+    case 'k':
+      if (std::string err; !Keyboard::parse(optarg, opts.keys, err)) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'b':
+      batch = optarg;
+      break;
+    case 'j': {
+      char *end;
+      unsigned long n = strtoul(optarg, &end, 10);
+      if (!isdigit((unsigned char)*optarg) || *end || !n || n > MAX_JOBS) {
+        std::cerr << "-j takes a count from 1 to " << MAX_JOBS << std::endl;
+        return EXIT_FAILURE;
+      }
+      jobs = n;
+      break;
+    }
+    case 'h':
+      usage();
+      return EXIT_SUCCESS;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (batch && (opts.cpu.trace || opts.cpu.tracefile || opts.cpu.profelf ||
+                opts.counters || opts.serialout || opts.screen ||
+                opts.headless || opts.audioout)) {
+    std::cerr << "--trace, --trace-file, --profile, --counters, --serial-out, "
+                 "--screen, --headless and --audio-out take a single image"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!opts.headless && (opts.frames || opts.dumpdir)) {
+    std::cerr << "--frames and --dump-dir need --headless" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (batch)
+    return run_batch(batch, jobs, opts);
+
+  if (optind >= argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if (opts.counters)
+    signal(SIGUSR1, request_dump);
+#ifdef DEBUG_MODE
+  if (opts.cpu.trace)
+    Debugger32::catch_interrupt();
+#endif
+
+  // a file takes the output in big chunks, a terminal line by line
+  FILE *serial = stdout;
+  if (opts.serialout && !(serial = fopen(opts.serialout, "w"))) {
+    std::cerr << "can not open " << opts.serialout << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Outcome res;
+  run_image(argv[optind], opts, serial, serial == stdout, res);
+  if (serial != stdout)
+    fclose(serial);
+  if (!res.opened) {
+    std::cerr << "can not open " << argv[optind] << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!res.panic.empty()) {
+    std::cerr << res.panic << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (res.framed && !res.halted)
+    return EXIT_SUCCESS;
+  if (!res.halted) {
+    std::cerr << "timeout after " << res.insts << " instructions" << std::endl;
+    return EXIT_FAILURE;
+  }
+  // the guest's status, one a process status would truncate to 0 still fails
+  if (res.exitcode && !(res.exitcode & 0xff))
+    return EXIT_FAILURE;
+  return res.exitcode & 0xff;
+}
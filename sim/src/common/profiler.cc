@@ -0,0 +1,151 @@
+#include <elf.h>
+
+#include "debug/profiler.hh"
+#include "common.hh"
+
+#define PROF_MAX_DEPTH 256
+
+Profiler::Profiler(const char *elf, uint64_t period)
+    : period(period), countdown(period) {
+  panicifnot(period > 0);
+  load_symbols(elf);
+}
+
+void Profiler::load_symbols(const char *elf) {
+  std::ifstream ifs(elf, std::ios::binary);
+  if (!ifs)
+    panic("can not open profile elf");
+  std::vector<char> img((std::istreambuf_iterator<char>(ifs)),
+                        std::istreambuf_iterator<char>());
+
+  auto *eh = (const Elf32_Ehdr *)img.data();
+  if (img.size() < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+      eh->e_ident[EI_CLASS] != ELFCLASS32)
+    panic("profile elf is not a 32-bit elf");
+  panicifnot(eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf32_Shdr) <=
+             img.size());
+
+  auto *sh = (const Elf32_Shdr *)(img.data() + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; ++i) {
+    if (sh[i].sh_type != SHT_SYMTAB)
+      continue;
+    panicifnot(sh[i].sh_link < eh->e_shnum &&
+               sh[i].sh_offset + sh[i].sh_size <= img.size());
+    const Elf32_Shdr &strtab = sh[sh[i].sh_link];
+    panicifnot(strtab.sh_offset + strtab.sh_size <= img.size());
+
+    auto *sym = (const Elf32_Sym *)(img.data() + sh[i].sh_offset);
+    size_t nsyms = sh[i].sh_size / sizeof(Elf32_Sym);
+    for (size_t j = 0; j < nsyms; ++j) {
+      if (ELF32_ST_TYPE(sym[j].st_info) != STT_FUNC || !sym[j].st_value ||
+          sym[j].st_name >= strtab.sh_size)
+        continue;
+      // the thumb bit is not part of the address
+      symbols.push_back({sym[j].st_value & ~1u, sym[j].st_size,
+                         img.data() + strtab.sh_offset + sym[j].st_name});
+    }
+  }
+
+  std::sort(symbols.begin(), symbols.end(),
+            [](auto &&a, auto &&b) { return a.addr < b.addr; });
+}
+
+std::string Profiler::symbolize(uint32_t addr) const {
+  auto it = std::upper_bound(
+      symbols.begin(), symbols.end(), addr,
+      [](uint32_t addr, auto &&sym) { return addr < sym.addr; });
+  if (it != symbols.begin()) {
+    --it;
+    // a symbol without size runs up to the next one
+    if (!it->size || addr < it->addr + it->size)
+      return it->name;
+  }
+
+  char buf[16];
+  sprintf(buf, "0x%08x", addr);
+  return buf;
+}
+
+void Profiler::sample(uint32_t pc) {
+  std::vector<uint32_t> key;
+  key.reserve(stack.size() + 1);
+  for (auto &&frame : stack)
+    key.push_back(frame.func);
+  key.push_back(pc);
+  samples[key] += 1;
+  nsamples += 1;
+}
+
+void Profiler::call(uint32_t func, uint32_t ret) {
+  // deep recursion forgets the outermost frames
+  if (stack.size() == PROF_MAX_DEPTH)
+    stack.erase(stack.begin());
+  stack.push_back({func & ~1u, ret & ~1u});
+}
+
+// jumps that match no return address, tail calls and the like, leave the
+// stack alone; frames sharing the return address unwind together
+void Profiler::ret(uint32_t target) {
+  target &= ~1u;
+  auto it = std::find_if(stack.rbegin(), stack.rend(),
+                         [=](auto &&frame) { return frame.ret == target; });
+  if (it == stack.rend())
+    return;
+  stack.erase(std::prev(it.base()), stack.end());
+  while (!stack.empty() && stack.back().ret == target)
+    stack.pop_back();
+}
+
+void Profiler::report(const char *prefix) const {
+  std::map<std::string, uint64_t> self, total, folded;
+
+  for (auto &&[key, count] : samples) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i + 1 < key.size(); ++i)
+      names.push_back(symbolize(key[i]));
+    std::string leaf = symbolize(key.back());
+    // the sampled pc is usually inside the innermost call
+    if (names.empty() || names.back() != leaf)
+      names.push_back(leaf);
+
+    self[leaf] += count;
+    std::set<std::string> seen(names.begin(), names.end());
+    for (auto &&name : seen)
+      total[name] += count;
+
+    std::string line;
+    for (auto &&name : names)
+      line += (line.empty() ? "" : ";") + name;
+    folded[line] += count;
+  }
+
+  std::string path = std::string(prefix) + ".flat";
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp)
+    panic("can not open profile output");
+  std::vector<std::pair<uint64_t, std::string>> order;
+  for (auto &&[name, count] : self)
+    order.push_back({count, name});
+  for (auto &&[name, count] : total)
+    if (!self.count(name))
+      order.push_back({0, name});
+  std::sort(order.begin(), order.end(), [&](auto &&a, auto &&b) {
+    return a.first != b.first ? a.first > b.first
+                              : total.at(a.second) > total.at(b.second);
+  });
+  fprintf(fp, "%" PRIu64 " samples\n", nsamples);
+  fprintf(fp, "%7s %7s  %s\n", "self%", "total%", "function");
+  double scale = 100.0 / std::max<uint64_t>(nsamples, 1);
+  for (auto &&[count, name] : order)
+    fprintf(fp, "%6.2f%% %6.2f%%  %s\n", count * scale, total.at(name) * scale,
+            name.c_str());
+  fclose(fp);
+
+  path = std::string(prefix) + ".folded";
+  fp = fopen(path.c_str(), "w");
+  if (!fp)
+    panic("can not open profile output");
+  for (auto &&[line, count] : folded)
+    fprintf(fp, "%s %" PRIu64 "\n", line.c_str(), count);
+  fclose(fp);
+}
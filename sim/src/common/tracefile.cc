@@ -0,0 +1,103 @@
+#include <zlib.h>
+
+#include "debug/tracefile.hh"
+#include "common.hh"
+
+namespace etrace {
+
+Writer::Writer(const char *path) {
+  fp = fopen(path, "wb");
+  if (!fp)
+    panic("can not open trace file");
+
+  char version[4];
+  store_le<uint32_t>(version, TRACE_VERSION);
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), fp);
+  fwrite(version, 1, sizeof(version), fp);
+
+  pool = new Block[TRACE_NR_BLOCKS];
+  for (size_t i = 1; i < TRACE_NR_BLOCKS; ++i)
+    spare.push(&pool[i]);
+  cur = &pool[0];
+  reset();
+
+  worker = std::thread(&Writer::drain, this);
+}
+
+Writer::~Writer() {
+  // a block with no records still carries what was lost before it
+  if (records || lost) {
+    cur->len = pos - cur->raw;
+    cur->lost = lost;
+    // every other block is queued or spare, so there is always a slot. A
+    // destructor can not throw, so this one never unwinds into a batch.
+    if (!full.push(cur)) {
+      fprintf(stderr, "trace writer has no slot for its last block\n");
+      abort();
+    }
+  }
+  done.store(true, std::memory_order_release);
+  worker.join();
+
+  fclose(fp);
+  delete[] pool;
+  if (dropped)
+    fprintf(stderr, "trace writer fell behind, %" PRIu64 " records dropped\n",
+            dropped);
+}
+
+// each block decodes on its own, so deltas restart
+void Writer::reset() {
+  pos = cur->raw;
+  nextpc = 0;
+  lastaddr = 0;
+  records = 0;
+}
+
+void Writer::flush() {
+  Block *next = spare.pop();
+  if (!next) {
+    lost += records;
+    dropped += records;
+    reset();
+    return;
+  }
+
+  cur->len = pos - cur->raw;
+  cur->lost = lost;
+  panicifnot(full.push(cur));
+  lost = 0;
+  cur = next;
+  reset();
+}
+
+void Writer::drain() {
+  std::vector<Bytef> out(compressBound(TRACE_BLOCK_SIZE));
+
+  for (;;) {
+    Block *blk = full.pop();
+    if (!blk) {
+      // the core pushes its last block before raising done
+      if (done.load(std::memory_order_acquire) && !(blk = full.pop()))
+        break;
+      if (!blk) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+    }
+
+    uLongf complen = out.size();
+    panicifnot(compress2(out.data(), &complen, blk->raw, blk->len,
+                         Z_BEST_SPEED) == Z_OK);
+    char head[16];
+    store_le<uint32_t>(head, blk->len);
+    store_le<uint32_t>(head + 4, complen);
+    store_le<uint64_t>(head + 8, blk->lost);
+    fwrite(head, 1, sizeof(head), fp);
+    fwrite(out.data(), 1, complen, fp);
+
+    spare.push(blk);
+  }
+}
+
+} // namespace etrace
@@ -3,6 +3,9 @@
 #include "common.hh"
 #include "cpu/cortex-m0.hh"
 #include "bus/sysbus.hh"
+#include "cpu/x64emit.hh"
+#include "debug/tracefile.hh"
+#include "debug/profiler.hh"
 
 namespace {
 
@@ -53,39 +56,100 @@ enum EXCEPTIONS {
 enum Mode {
   Mode_Thread,
   Mode_Handler,
-} mstatus;
+};
 
 struct PRIMASK {
   bool PRIMASK;
-} PMASK;
+};
 
 struct CONTROL {
   bool SPSEL;
-} CTRL;
+};
 
 struct PSR {
-  // uint32_t psr;
+  // apsr, evaluated lazily: N and Z come from the last flag-setting result,
+  // C and V are derived from the operands of the last add/sub when read
+  uint32_t nzres = 1;
+  bool zn = false; // Z set alongside N, which no single result gives
+  uint32_t addx = 0;
+  uint32_t addy = 0;
+  bool addcin = false;
+  bool clazy = false;
+  bool vlazy = false;
+  bool c = false; // carry
+  bool v = false; // overflow
 
-  // apsr
-  bool N; // neg
-  bool Z; // zero
-  bool C; // carry
-  bool V; // overflow
+  // epsr
+  bool T = true; // thumb
 
   // ipsr
-  bool T; // thumb
+  uint32_t ISR_idx = 0; // exception number, 0 in thread mode
 
-  // epsr
-  uint32_t ISR_idx; // interrupt service
-} xPSR;
+  bool N() { return nzres >> 31; }
+  bool Z() { return nzres == 0 || zn; }
+
+  bool C() {
+    if (clazy) {
+      c = ((uint64_t)addx + addy + addcin) >> 32;
+      clazy = false;
+    }
+    return c;
+  }
+
+  bool V() {
+    if (vlazy) {
+      uint32_t sum = addx + addy + addcin;
+      v = ((addx ^ sum) & (addy ^ sum)) >> 31;
+      vlazy = false;
+    }
+    return v;
+  }
+
+  uint32_t apsr() { return N() << 31 | Z() << 30 | C() << 29 | V() << 28; }
+
+  uint32_t xpsr() { return apsr() | T << 24 | ISR_idx; }
+
+  void set_apsr(uint32_t psr) {
+    bool n = psr >> 31, z = psr >> 30 & 1;
+    nzres = n ? 0x80000000 : !z;
+    zn = n && z;
+    c = psr >> 29 & 1;
+    v = psr >> 28 & 1;
+    clazy = vlazy = false;
+  }
+
+  void set_nz(uint32_t result) {
+    nzres = result;
+    zn = false;
+  }
+
+  void set_nzc(uint32_t result, bool carry) {
+    nzres = result;
+    zn = false;
+    c = carry;
+    clazy = false;
+  }
+
+  void set_add(uint32_t x, uint32_t y, bool carry_in, uint32_t result) {
+    nzres = result;
+    zn = false;
+    addx = x;
+    addy = y;
+    addcin = carry_in;
+    clazy = vlazy = true;
+  }
+};
 
 struct Reg {
+  CONTROL &CTRL; // picks the banked sp
   uint32_t regs[13] = {0};
   uint32_t _LR = 0;
   uint32_t _PC = 0;
   uint32_t sp_process = 0;
   uint32_t sp_main = 0;
 
+  Reg(CONTROL &ctrl) : CTRL(ctrl) {}
+
   uint32_t get(uint32_t idx) {
     panicifnot(idx >= 0 && idx <= 15);
     if (idx == 15)
@@ -127,144 +191,293 @@ struct Reg {
     regs[idx] = value;
   }
 
+  // r0-r7, for operands whose field is only three bits wide
+  uint32_t lo(uint32_t idx) { return regs[idx & 7]; }
+  void set_lo(uint32_t idx, uint32_t value) { regs[idx & 7] = value; }
+
   void pc_inc(uint32_t value) { _PC += value; }
   uint32_t inst_addr() { return _PC; }
-} R;
+};
 
 
-class Trie {
-  using exectype = void (*)(uint32_t);
+struct Insn;
+using exectype = void (CpuState::*)(const Insn &);
+using jitfn = uint32_t (*)(CpuState *);
 
-  struct node {
+class Decoder {
+  // 32-bit encodings all start with 0b11110, the low 11 bits of the first
+  // halfword select a bucket and the second halfword is matched in it
+  struct entry32 {
+    uint16_t mask;
+    uint16_t match;
+    uint32_t prio; // the whole mask
     exectype exec;
-    bool is_terminal = false;
-    node *next[3] = {nullptr};
   };
 
-  node *root;
-
-  exectype search_from(node *nwroot, uint32_t inst, uint32_t start) {
-    node *walker = nwroot;
-    if (!nwroot) return nullptr;
-    if (!start) {
-      if (nwroot->is_terminal) {
-        return nwroot->exec;
-      } else {
-        return nullptr;
-      }
-    }
-    uint32_t mask = 1 << (start - 1);
-    exectype func = nullptr;
-    while (mask) {
-      size_t nxt = !!(mask & inst);
-      if (walker->next[nxt] == nullptr) {
-        if (walker->next[2] == nullptr) {
-          return nullptr;
-        }
-        walker = walker->next[2];
-        mask = mask >> 1;
-        start -= 1;
-        continue;
-      }
-
-      func = search_from(walker->next[nxt], inst, start - 1);
-      if (func)
-        return func;
+  struct bucket {
+    entry32 entries[4];
+    uint32_t count = 0;
+  };
 
-      func = search_from(walker->next[2], inst, start - 1);
-      if (func)
-        return func;
+  exectype table16[1 << 16] = {nullptr};
+  uint16_t prio16[1 << 16] = {0};
+  bucket table32[1 << 11];
 
-      break;
+  static void parse(const char *word, uint32_t &mask, uint32_t &match,
+                    uint32_t &width) {
+    mask = match = width = 0;
+    for (const char *p = word; p && *p; ++p) {
+      if (*p == ' ' || *p == '\'')
+        continue;
+      panicifnot(*p == 'x' || *p == '1' || *p == '0');
+      mask = (mask << 1) | (*p != 'x');
+      match = (match << 1) | (*p == '1');
+      width += 1;
     }
-    if (walker->is_terminal)
-      return walker->exec;
-
-    return nullptr;
+    panicifnot(width == 16 || width == 32);
   }
 
-public:
-  Trie() : root(new node) {}
-
-  void insert(const char *word, exectype exec) {
-    node *walker = root;
-    const char *p = word;
-    while (p && *p) {
-      if (*p == ' ' || *p == '\'') {
-        p++;
-        continue;
+  // Of two patterns that both match, the one fixing a bit the other leaves
+  // as x, at the first such bit from the top, wins. That is the old trie's
+  // order, it tried the 0/1 child before the x child at every level, and it
+  // comes down to the numerically larger mask winning. Equal masks that
+  // overlap are the same pattern twice.
+  void insert16(uint32_t mask, uint32_t match, exectype exec) {
+    uint32_t free = ~mask & Lo32Mask<16>;
+    uint32_t sub = free;
+    do {
+      uint32_t inst = match | sub;
+      if (table16[inst] && prio16[inst] == mask)
+        panic("?? what fxxk with this isa?");
+      if (!table16[inst] || prio16[inst] < mask) {
+        prio16[inst] = mask;
+        table16[inst] = exec;
       }
-      size_t nxt = *p == 'x' ? 2 : *p == '1' ? 1 : *p == '0' ? 0 : -1;
-      panicifnot(nxt != -1);
-      if (walker->next[nxt] == nullptr) {
-        walker->next[nxt] = new node;
+      sub = (sub - 1) & free;
+    } while (sub != free);
+  }
+
+  void insert32(uint32_t mask, uint32_t match, exectype exec) {
+    panicifnot(((mask & match) >> 27) == 0b11110);
+    uint32_t free = ~(mask >> 16) & Lo32Mask<11>;
+    uint32_t sub = free;
+    do {
+      bucket &b = table32[(match >> 16 | sub) & Lo32Mask<11>];
+      panicifnot(b.count < 4);
+      for (uint32_t j = 0; j < b.count; ++j) {
+        if (b.entries[j].prio == mask && b.entries[j].match == uint16_t(match))
+          panic("?? what fxxk with this isa?");
       }
-      walker = walker->next[nxt];
-      p++;
-    }
-    if (walker->is_terminal)
-      panic("?? what fxxk with this isa?");
-    walker->is_terminal = true;
-    walker->exec = exec;
-  }
-
-  exectype search(uint32_t inst, uint32_t start) {
-    node *walker = root;
-    uint32_t mask = 1 << (start - 1);
-    exectype func = nullptr;
-    while (mask) {
-      size_t nxt = !!(mask & inst);
-      if (walker->next[nxt] == nullptr) {
-        if (walker->next[2] == nullptr) {
-          return nullptr;
-        }
-        walker = walker->next[2];
-        mask = mask >> 1;
-        start -= 1;
-        continue;
+      // same order as insert16, kept sorted so search takes the first hit
+      uint32_t i = b.count++;
+      while (i > 0 && b.entries[i - 1].prio < mask) {
+        b.entries[i] = b.entries[i - 1];
+        i--;
       }
+      b.entries[i] = {uint16_t(mask), uint16_t(match), mask, exec};
+      sub = (sub - 1) & free;
+    } while (sub != free);
+  }
 
-      func = search_from(walker->next[nxt], inst, start - 1);
-      if (func)
-        break;
+public:
+  Decoder();
 
-      func = search_from(walker->next[2], inst, start - 1);
-      break;
-    }
-    return func;
+  void insert(const char *word, exectype exec) {
+    uint32_t mask, match, width;
+    parse(word, mask, match, width);
+    if (width == 16)
+      insert16(mask, match, exec);
+    else
+      insert32(mask, match, exec);
   }
 
-  void clear_node(node *walker) {
-    for (size_t i = 0; i < 3; ++i) {
-      if (walker->next[i]) {
-        clear_node(walker->next[i]);
-        delete walker->next[i];
-        walker->next[i] = nullptr;
-      }
+  exectype search(uint32_t inst, uint32_t start) const {
+    if (start == 16)
+      return table16[inst & Lo32Mask<16>];
+
+    const bucket &b = table32[(inst >> 16) & Lo32Mask<11>];
+    for (uint32_t i = 0; i < b.count; ++i) {
+      if ((inst & b.entries[i].mask) == b.entries[i].match)
+        return b.entries[i].exec;
     }
-    walker->exec = nullptr;
-    walker->is_terminal = false;
+    return nullptr;
   }
+};
 
-  ~Trie() {
-    clear_node(root);
-    delete root;
-  }
-} dict;
+// the decode table never changes once built, all cores share it
+const Decoder dict;
+
+#define NR_BLOCKS 2048
+#define BLOCK_INSTS 32
+#define CODE_LINE_SHIFT 8
+#define IDLE_POLLS 16     // unchanged polls before the guest counts as idle
+#define IDLE_SLEEP_US 100 // host sleep when idle with no event to skip to
+
+struct Insn {
+  exectype exec;
+  uint32_t inst;
+  uint16_t size;
+  uint16_t id; // index of exec in handlers
+  // operands, see decode_operands
+  uint8_t d, n, m, cond;
+  uint32_t imm;
+#ifdef THREADED_DISPATCH
+  void *label;
+#endif
+};
 
-using std::pair;
+struct Block {
+  uint32_t addr = 1; // odd, never a valid pc
+  uint32_t end = 1;
+  uint32_t len = 0;
+  uint32_t hits = 0;
+  uint64_t runs = 0; // complete runs, not yet added to the handler counts
+  jitfn code = nullptr;
+  Insn insts[BLOCK_INSTS];
+};
 
-static SystemBus *sysbus;
+class Translator;
 
-static Debugger32 dbgr;
+using std::pair;
 
 } // namespace
 
 //
-// ----- ----- Help ----- -----
+// ----- ----- State ----- -----
 //
 
-static bool isinst16 = false, nojmp = true;
+#define CM0_HANDLERS(X) \
+  X(adc_reg_t1) X(add_imm_t1) X(add_imm_t2) X(add_reg_t1) X(add_reg_t2) \
+  X(add_sp_imm_t1) X(add_sp_imm_t2) X(add_sp_reg_t1) X(add_sp_reg_t2) \
+  X(adr_t1) X(and_reg_t1) X(asr_imm_t1) X(asr_reg_t1) X(b_t1) X(b_t2) \
+  X(bic_reg_t1) X(bkpt_t1) X(bl_t1) X(blx_reg_t1) X(bx_t1) X(cmn_reg_t1) \
+  X(cmp_imm_t1) X(cmp_reg_t1) X(cmp_reg_t2) X(cps_t1) X(dmb_t1) X(dsb_t1) \
+  X(eor_reg_t1) X(isb_t1) X(ldm_t1) X(ldr_imm_t1) X(ldr_imm_t2) X(ldr_lit_t1) \
+  X(ldr_reg_t1) X(ldrb_imm_t1) X(ldrb_reg_t1) X(ldrh_imm_t1) X(ldrh_reg_t1) \
+  X(ldrsb_reg_t1) X(ldrsh_reg_t1) X(lsl_imm_t1) X(lsl_reg_t1) X(lsr_imm_t1) \
+  X(lsr_reg_t1) X(mov_imm_t1) X(mov_reg_t1) X(mov_reg_t2) X(mrs_t1) \
+  X(msr_reg_t1) X(mul_t1) X(mvn_reg_t1) X(nop_t1) X(orr_reg_t1) X(pop_t1) \
+  X(push_t1) X(rev_t1) X(rev16_t1) X(revsh_t1) X(ror_reg_t1) X(rsb_imm_t1) \
+  X(sbc_reg_t1) X(sev_t1) X(stm_t1) X(str_imm_t1) X(str_imm_t2) X(str_reg_t1) \
+  X(strb_imm_t1) X(strb_reg_t1) X(strh_imm_t1) X(strh_reg_t1) X(sub_imm_t1) \
+  X(sub_imm_t2) X(sub_reg_t1) X(sub_sp_imm_t1) X(svc_t1) X(sxtb_t1) \
+  X(sxth_t1) X(tst_reg_t1) X(udf_t1) X(udf_t2) X(uxtb_t1) X(uxth_t1) \
+  X(wfe_t1) X(wfi_t1) X(yield_t1)
+
+#define X(name) +1
+static constexpr size_t NR_HANDLERS = 0 CM0_HANDLERS(X);
+#undef X
+
+struct CpuState {
+  Mode mstatus;
+  PRIMASK PMASK;
+  CONTROL CTRL;
+  PSR xPSR;
+  Reg R{CTRL};
+
+  SystemBus *sysbus;
+  Nvic *nvic = nullptr; // nullptr on a core without interrupts
+  Debugger32 dbgr;
+  // record every instruction, register change, access and jump in dbgr
+  bool trace = false;
+  // stream every instruction and access to disk
+  etrace::Writer *tracefile = nullptr;
+  // either of the above, selects the traced interpreter
+  bool tracing = false;
+  Profiler *profiler = nullptr;
+  const char *profout = nullptr;
+
+  // guest time, cycles up to the start of curblk
+  uint64_t cycles = 0;
+  uint32_t cpi = 1;
+  Block *curblk = nullptr;
+
+  // a guest is idle when it sits in wfi, or keeps reading the same device
+  // values back into the same registers at the same pc
+  bool idleskip = false;
+  bool event = false;
+  uint64_t ioseen = 0;
+  uint32_t pollregs[16] = {0};
+  uint32_t polls = 0;
+  uint64_t skipped = 0; // cycles fast-forwarded
+  uint64_t sleeps = 0;
+
+  bool isinst16 = false, nojmp = true, halted = false;
+  uint32_t exitcode = 0;
+
+  // decoded blocks, keyed by guest pc
+  Block blocks[NR_BLOCKS];
+  // one bit per 256 bytes of guest address space that holds cached code, kept
+  // as plain words so translated code can test it with bt
+  uint64_t codelines[(1ull << (32 - CODE_LINE_SHIFT)) / 64] = {0};
+  bool blkinval = false;
+  Translator *translator = nullptr;
+  // a panic under translated code, which it can not unwind through; the
+  // helper records it and the block side-exits to have it rethrown
+  std::exception_ptr fault;
+
+  // instructions retired by each handler, less those in Block::runs
+  uint64_t handler_counts[NR_HANDLERS] = {0};
+  uint64_t branches_taken = 0;
+  uint64_t branches_not_taken = 0;
+
+  CpuState(SystemBus *bus, Nvic *nvic, const CpuOptions &opts);
+  ~CpuState();
+
+  void exception_entry(uint32_t exc, uint32_t retaddr);
+  void exception_return(uint32_t address);
+  void take_exception();
+  void bkpt_instr_debug_event();
+  void call_supervisor();
+  bool current_mode_is_privileged();
+  void exception_taken(uint32_t id);
+  bool event_registered();
+  void clear_event_register();
+  void wait_for_interrupt();
+  void wait_for_event();
+  void hint_send_event();
+  void hint_yield();
+  void data_memory_barrier(uint32_t option);
+  void data_synchronization_barrier(uint32_t option);
+  void instruction_synchronization_barrier(uint32_t option);
+
+  void trace_mem(uint32_t address, uint32_t data, uint32_t size, bool write);
+  uint32_t mem_access_aligned(uint32_t address, uint32_t size);
+  void mem_modify_aligned(uint32_t data, uint32_t address, uint32_t size);
+  uint32_t add_with_flags(uint32_t x, uint32_t y, bool carry_in);
+
+  void branch_to(uint32_t address);
+  void branch_write_pc(uint32_t address);
+  void bx_write_pc(uint32_t address);
+  void blx_write_pc(uint32_t address);
+  void load_write_pc(uint32_t address);
+  void alu_write_pc(uint32_t address);
+  bool condition_passed(uint32_t cond);
+
+#define X(name) void exec_##name(const Insn &insn);
+  CM0_HANDLERS(X)
+#undef X
+
+  Block &fetch_block(uint32_t addr);
+  void invalidate_code(uint32_t address);
+  template <bool TRACE> void exec_insn(const Insn &insn);
+  template <bool TRACE> uint32_t run_block(Block &blk, uint32_t len);
+  uint32_t run_next(uint32_t budget);
+  void retire(Block &blk, uint32_t n);
+  uint64_t now();
+  void check_poll();
+  void idle();
+  void dump_counters(FILE *fp);
+#ifdef THREADED_DISPATCH
+  void *threaded_label(exectype exec);
+  uint32_t run_threaded(Block *blk, uint32_t len);
+#endif
+  unsigned step(unsigned in);
+};
+
+//
+// ----- ----- Help ----- -----
+//
 
 #define DINST(inst, hi, lo) (((inst) & Mask32<(hi), (lo)>) >> (lo))
 #define SEXT32(x, width) ((int32_t((x) << (32 - (width)))) >>  (32 - (width)))
@@ -292,52 +505,143 @@ static inline uint32_t bit_count(uint32_t x) {
 // ----- ----- Exceptions ----- -----
 //
 
-static void blx_write_pc(uint32_t addr);
+// pushes r0-r3, r12, lr, the return address and xpsr on the stack in use,
+// realigned to 8 bytes, and enters the handler with lr set to EXC_RETURN
+void CpuState::exception_entry(uint32_t exc, uint32_t retaddr) {
+  uint32_t vector = 0;
+  sysbus->read32(vector, IMG_ADDR + 4 * exc);
+  if (!vector)
+    panic("exception without a handler");
+
+  bool psp = mstatus == Mode_Thread && CTRL.SPSEL;
+  uint32_t sp = psp ? R.sp_process : R.sp_main;
+  uint32_t frame = (sp - 0x20) & ~4u;
+  uint32_t stacked[8] = {R.get(0),  R.get(1),  R.get(2), R.get(3),
+                         R.get(12), R.get(LR), retaddr,
+                         xPSR.xpsr() | (sp & 4) << 7};
+  for (uint32_t i = 0; i < 8; ++i)
+    mem_modify_aligned(stacked[i], frame + 4 * i, 4);
+  (psp ? R.sp_process : R.sp_main) = frame;
+
+  R.set(LR, mstatus == Mode_Handler ? 0xfffffff1
+            : psp                   ? 0xfffffffd
+                                    : 0xfffffff9);
+  mstatus = Mode_Handler;
+  CTRL.SPSEL = 0;
+  xPSR.ISR_idx = exc;
+  if (profiler)
+    profiler->call(vector, retaddr);
+  blx_write_pc(vector);
+}
 
-static void exception_return(uint32_t address) {
+void CpuState::exception_return(uint32_t address) {
   panicifnot(mstatus == Mode_Handler);
-}
 
-static void bkpt_instr_debug_event() {}
+  bool thread, psp;
+  switch (address & Mask32<3, 0>) {
+  case 0x1:
+    thread = psp = false;
+    break;
+  case 0x9:
+    thread = true;
+    psp = false;
+    break;
+  case 0xd:
+    thread = psp = true;
+    break;
+  default:
+    panic("unpredictable");
+  }
 
-static void call_supervisor() {
-  uint32_t svc_service = 0;
-  sysbus->read32(svc_service, IMG_ADDR + 0x2c);
-  blx_write_pc(svc_service);
+  uint32_t exc = xPSR.ISR_idx;
+  uint32_t frame = psp ? R.sp_process : R.sp_main;
+  uint32_t stacked[8];
+  for (uint32_t i = 0; i < 8; ++i)
+    stacked[i] = mem_access_aligned(frame + 4 * i, 4);
+  (psp ? R.sp_process : R.sp_main) = frame + 0x20 + (stacked[7] >> 9 & 1) * 4;
+
+  mstatus = thread ? Mode_Thread : Mode_Handler;
+  CTRL.SPSEL = psp;
+  for (uint32_t i = 0; i < 4; ++i)
+    R.set(i, stacked[i]);
+  R.set(12, stacked[4]);
+  R.set(LR, stacked[5]);
+  xPSR.set_apsr(stacked[7]);
+  xPSR.ISR_idx = stacked[7] & Mask32<5, 0>;
+  if (nvic)
+    nvic->retire(exc, xPSR.ISR_idx);
+  if (profiler)
+    profiler->ret(stacked[6]);
+  branch_to(stacked[6] & Mask32<31, 1>);
+}
+
+// between blocks, pc is the next instruction to run
+void CpuState::take_exception() {
+  uint32_t exc = nvic->take(PMASK.PRIMASK);
+  if (!exc)
+    return;
+  exception_entry(exc, R.inst_addr());
+  nojmp = true;
 }
 
-static bool current_mode_is_privileged() {
-  return mstatus == Mode_Handler;
+void CpuState::bkpt_instr_debug_event() {}
+
+// synchronous, the handler returns to the instruction after svc
+void CpuState::call_supervisor() {
+  if (nvic)
+    nvic->enter(EXC_SVCALL);
+  exception_entry(EXC_SVCALL, R.inst_addr() + 2);
 }
 
-static void exception_taken(uint32_t id) {}
+// armv6-m without the unprivileged extension runs everything privileged
+bool CpuState::current_mode_is_privileged() { return true; }
+
+// faults are raised from the middle of an instruction, which the core can
+// not unwind, so they stay fatal
+void CpuState::exception_taken(uint32_t id) { panic("hard fault"); }
 
-static bool event_registered() { return false; }
+bool CpuState::event_registered() { return event; }
 
-static void clear_event_register() {}
+void CpuState::clear_event_register() { event = false; }
 
-static void wait_for_interrupt() {}
+void CpuState::wait_for_interrupt() {
+  if (idleskip && !(nvic && nvic->wakeup()))
+    idle();
+}
 
-static void wait_for_event() {}
+void CpuState::wait_for_event() {
+  if (idleskip && !(nvic && nvic->wakeup()))
+    idle();
+}
 
-static void hint_send_event() {}
+void CpuState::hint_send_event() { event = true; }
 
-static void hint_yield() {
+// yield stops the simulation, r0 holds the guest's exit status
+void CpuState::hint_yield() {
   Log("hit yield");
-  exit(EXIT_SUCCESS);
+  exitcode = R.get(0);
+  halted = true;
 }
 
 //
 // ----- ----- MEM MISC ----- -----
 //
 
-static void data_memory_barrier(uint32_t option) {}
+void CpuState::data_memory_barrier(uint32_t option) {}
 
-static void data_synchronization_barrier(uint32_t option) {}
+void CpuState::data_synchronization_barrier(uint32_t option) {}
 
-static void instruction_synchronization_barrier(uint32_t option) {}
+void CpuState::instruction_synchronization_barrier(uint32_t option) {}
 
-static uint32_t mem_access_aligned(uint32_t address, uint32_t size) {
+void CpuState::trace_mem(uint32_t address, uint32_t data, uint32_t size,
+                         bool write) {
+  if (trace)
+    dbgr.pushmem(address, data, !write);
+  if (tracefile)
+    tracefile->mem(address, data, size, write);
+}
+
+uint32_t CpuState::mem_access_aligned(uint32_t address, uint32_t size) {
   if (ALIGN(address, size) != address) {
     exception_taken(HardFault);
   }
@@ -345,26 +649,20 @@ static uint32_t mem_access_aligned(uint32_t address, uint32_t size) {
   if (size == 4) {
     uint32_t recv;
     sysbus->read32(recv, address);
-
-#ifdef DEBUG_MODE
-  dbgr.pushmem(address, recv, true);
-#endif
+    if (tracing)
+      trace_mem(address, recv, size, false);
     return recv;
   } else if (size == 2) {
     uint16_t recv;
     sysbus->read16(recv, address);
-
-#ifdef DEBUG_MODE
-  dbgr.pushmem(address, recv, true);
-#endif
+    if (tracing)
+      trace_mem(address, recv, size, false);
     return (uint32_t)recv;
   } else if (size == 1) {
     uint8_t recv;
     sysbus->read8(recv, address);
-
-#ifdef DEBUG_MODE
-  dbgr.pushmem(address, recv, true);
-#endif
+    if (tracing)
+      trace_mem(address, recv, size, false);
     return (uint32_t)recv;
   }
 
@@ -372,14 +670,15 @@ static uint32_t mem_access_aligned(uint32_t address, uint32_t size) {
   return 0;
 }
 
-static void mem_modify_aligned(uint32_t data, uint32_t address, uint32_t size) {
+void CpuState::mem_modify_aligned(uint32_t data, uint32_t address, uint32_t size) {
   if (ALIGN(address, size) != address) {
     exception_taken(HardFault);
   }
 
-#ifdef DEBUG_MODE
-  dbgr.pushmem(address, data, false);
-#endif
+  invalidate_code(address);
+
+  if (tracing)
+    trace_mem(address, data, size, true);
 
   if (size == 4) {
     uint32_t recv = data;
@@ -402,11 +701,13 @@ static void mem_modify_aligned(uint32_t data, uint32_t address, uint32_t size) {
 // ----- ----- ALU ----- -----
 //
 
+// register shifts reach these with amounts up to 255, which C++ does not
+// define for 32-bit operands, so wide amounts are clamped explicitly
+
 static pair<uint32_t, bool> lsl_c(uint32_t x, uint32_t shamt) {
   panicifnot(shamt > 0);
-  uint32_t ext_x = x << shamt;
-  bool carry = !!(x & (0x1 << (32 - shamt)));
-  return {ext_x, carry};
+  uint64_t ext = (uint64_t)x << std::min(shamt, 33u);
+  return {(uint32_t)ext, !!(ext >> 32 & 1)};
 }
 
 static uint32_t lsl(uint32_t x, uint32_t shamt) {
@@ -420,8 +721,8 @@ static uint32_t lsl(uint32_t x, uint32_t shamt) {
 
 static pair<uint32_t, bool> lsr_c(uint32_t x, uint32_t shamt) {
   panicifnot(shamt > 0);
-  uint32_t ext_x = x >> shamt;
-  bool carry = !!(x & (0x1 << (shamt - 1)));
+  uint32_t ext_x = shamt > 31 ? 0 : x >> shamt;
+  bool carry = shamt > 32 ? false : !!(x >> (shamt - 1) & 1);
   return {ext_x, carry};
 }
 
@@ -436,8 +737,8 @@ static uint32_t lsr(uint32_t x, uint32_t shamt) {
 
 static pair<uint32_t, bool> asr_c(uint32_t x, uint32_t shamt) {
   panicifnot(shamt > 0);
-  uint32_t ext_x = ((int32_t)x >> shamt);
-  bool carry = shamt > 31 ? ((int32_t)x < 0) : !!(x & (0x1 << (shamt - 1)));
+  uint32_t ext_x = (int32_t)x >> std::min(shamt, 31u);
+  bool carry = !!((int32_t)x >> std::min(shamt - 1, 31u) & 1);
   return {ext_x, carry};
 }
 
@@ -477,25 +778,30 @@ static pair<uint32_t, pair<bool, bool>> add_with_carry(uint32_t x, uint32_t y,
   return {sum, {carry, overflow}};
 }
 
+uint32_t CpuState::add_with_flags(uint32_t x, uint32_t y, bool carry_in) {
+  uint32_t result = x + y + carry_in;
+  xPSR.set_add(x, y, carry_in, result);
+  return result;
+}
+
 
 //
 // ----- ----- Core op ----- -----
 //
 
-static void branch_to(uint32_t address) {
-#ifdef DEBUG_MODE
-  dbgr.pushjmp(address);
-#endif
+void CpuState::branch_to(uint32_t address) {
+  if (trace)
+    dbgr.pushjmp(address);
 
   R.set(PC, address);
   nojmp = false;
 }
 
-static void branch_write_pc(uint32_t address) {
+void CpuState::branch_write_pc(uint32_t address) {
   branch_to(Mask32<31, 1> & address);
 }
 
-static void bx_write_pc(uint32_t address) {
+void CpuState::bx_write_pc(uint32_t address) {
   if (mstatus == Mode_Handler && ((address & Mask32<31, 28>) >> 28) == 0b1111) {
     exception_return(address & Mask32<27, 0>);
     return;
@@ -504,43 +810,43 @@ static void bx_write_pc(uint32_t address) {
   branch_to(address & Mask32<31, 1>);
 }
 
-static void blx_write_pc(uint32_t address) {
+void CpuState::blx_write_pc(uint32_t address) {
   xPSR.T = address & Mask32<0, 0>;
   branch_to(address & Mask32<31, 1>);
 }
 
-static void load_write_pc(uint32_t address) { bx_write_pc(address); }
+void CpuState::load_write_pc(uint32_t address) { bx_write_pc(address); }
 
-static void alu_write_pc(uint32_t address) { branch_write_pc(address); }
+void CpuState::alu_write_pc(uint32_t address) { branch_write_pc(address); }
 
 //
 // ----- ----- Condition ----- -----
 //
 
-static bool condition_passed(uint32_t cond) {
+bool CpuState::condition_passed(uint32_t cond) {
   bool result = false;
 
   switch ((cond & Mask32<3, 1>) >> 1) {
   case 0b000:
-    result = (xPSR.Z == 1);
+    result = (xPSR.Z() == 1);
     break;
   case 0b001:
-    result = (xPSR.C == 1);
+    result = (xPSR.C() == 1);
     break;
   case 0b010:
-    result = (xPSR.N == 1);
+    result = (xPSR.N() == 1);
     break;
   case 0b011:
-    result = (xPSR.V == 1);
+    result = (xPSR.V() == 1);
     break;
   case 0b100:
-    result = (xPSR.C == 1) && (xPSR.Z == 0);
+    result = (xPSR.C() == 1) && (xPSR.Z() == 0);
     break;
   case 0b101:
-    result = (xPSR.N == xPSR.V);
+    result = (xPSR.N() == xPSR.V());
     break;
   case 0b110:
-    result = (xPSR.N == xPSR.V) && (xPSR.Z == 0);
+    result = (xPSR.N() == xPSR.V()) && (xPSR.Z() == 0);
     break;
   case 0b111:
     result = true;
@@ -639,92 +945,47 @@ static uint32_t shift(uint32_t value, SRType type, uint32_t amount,
 // ----- ----- exec ----- -----
 //
 
-static void exec_adc_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), R.get(m), xPSR.C);
-  auto &&[carry, overflow] = bols;
+// operands come from decode_operands, t is kept in d
 
-  R.set(d, result);
+void CpuState::exec_adc_reg_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), R.lo(insn.m), xPSR.C());
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_add_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm3 = DINST(inst, 8, 6);
-  uint32_t imm32 = imm3;
+void CpuState::exec_add_imm_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), insn.imm, false);
 
-  auto &&[result, bols] = add_with_carry(R.get(n), imm32, false);
-  auto &&[carry, overflow] = bols;
-
-  R.set(d, result);
-  
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_add_imm_t2(uint32_t inst) {
-  uint32_t d = DINST(inst, 10, 8);
-  uint32_t n = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
-  auto &&[result, bols] = add_with_carry(R.get(n), imm32, false);
-  auto &&[carry, overflow] = bols;
+void CpuState::exec_add_imm_t2(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), insn.imm, false);
   
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_add_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), R.get(m), false);
-  auto &&[carry, overflow] = bols;
-
-  R.set(d, result);
+void CpuState::exec_add_reg_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), R.lo(insn.m), false);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_add_sp_reg_t1(uint32_t inst);
-static void exec_add_sp_reg_t2(uint32_t inst);
 
-static void exec_add_reg_t2(uint32_t inst) {
-  uint32_t Rdn = DINST(inst, 2, 0);
-  uint32_t Rm = DINST(inst, 6, 3);
-  uint32_t DN = DINST(inst, 7, 7);
+void CpuState::exec_add_reg_t2(const Insn &insn) {
+  uint32_t d = insn.d;
+  uint32_t n = insn.n;
+  uint32_t m = insn.m;
 
-  if (Rm == 0b1101) {
-    exec_add_sp_reg_t1(inst);
+  // both sp forms read the same fields out of this encoding
+  if (m == 0b1101) {
+    exec_add_sp_reg_t1(insn);
     return;
-  } else if ((((DN << 3) | Rdn) == 0b1101)) {
-    exec_add_sp_reg_t2(inst);
+  } else if (d == 0b1101) {
+    exec_add_sp_reg_t2(insn);
     return;
   }
 
-  uint32_t d = ((DN << 3) | Rdn);
-  uint32_t n = ((DN << 3) | Rdn);
-  uint32_t m = Rm;
-
   if (n == 15 && m == 15)
     panic("unpredictable");
 
@@ -738,31 +999,20 @@ static void exec_add_reg_t2(uint32_t inst) {
   }
 }
 
-static void exec_add_sp_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8 << 2;
-
-  auto &&[result, _] = add_with_carry(R.get(SP), imm32, false);
+void CpuState::exec_add_sp_imm_t1(const Insn &insn) {
+  auto &&[result, _] = add_with_carry(R.get(SP), insn.imm, false);
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_add_sp_imm_t2(uint32_t inst) {
-  uint32_t d = 13;
-  uint32_t imm7 = DINST(inst, 6, 0);
-  uint32_t imm32 = imm7 << 2;
-
-  auto &&[result, _] = add_with_carry(R.get(SP), imm32, false);
+void CpuState::exec_add_sp_imm_t2(const Insn &insn) {
+  auto &&[result, _] = add_with_carry(R.get(SP), insn.imm, false);
   
-  R.set(d, result);
+  R.set(SP, result);
 }
 
-static void exec_add_sp_reg_t1(uint32_t inst) {
-  uint32_t Rdm = DINST(inst, 2, 0);
-  uint32_t DM = DINST(inst, 7, 7);
-
-  uint32_t d = ((DM << 3) | Rdm);
+void CpuState::exec_add_sp_reg_t1(const Insn &insn) {
+  uint32_t d = insn.d;
   uint32_t m = d;
 
   auto &&[result, _] = add_with_carry(R.get(SP), R.get(m), false);
@@ -775,139 +1025,91 @@ static void exec_add_sp_reg_t1(uint32_t inst) {
 
 }
 
-static void exec_add_sp_reg_t2(uint32_t inst) {
-  uint32_t Rm = DINST(inst, 6, 3);
-
-  uint32_t d = 13;
-  uint32_t m = Rm;
-
-  auto &&[result, _] = add_with_carry(R.get(SP), R.get(m), false);
+void CpuState::exec_add_sp_reg_t2(const Insn &insn) {
+  auto &&[result, _] = add_with_carry(R.get(SP), R.get(insn.m), false);
   
-  R.set(d, result);
+  R.set(SP, result);
 }
 
-static void exec_adr_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8 << 2;
-
-  uint32_t result = ALIGN(R.get(PC), 4) + imm32;
+void CpuState::exec_adr_t1(const Insn &insn) {
+  uint32_t result = ALIGN(R.get(PC), 4) + insn.imm;
 
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_and_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t result = R.get(n) & R.get(m);
+void CpuState::exec_and_reg_t1(const Insn &insn) {
+  uint32_t result = R.lo(insn.n) & R.lo(insn.m);
 
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  xPSR.set_nz(result);
 
   // assuming C V wiil not change
 }
 
-static void exec_asr_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  auto &&[_, shift_n] = decode_imm_shift(0b10, imm5);
+void CpuState::exec_asr_imm_t1(const Insn &insn) {
+  auto &&[result, carry] = shift_c(R.lo(insn.m), SR_ASR, insn.imm, xPSR.C());
 
-  auto &&[result, carry] = shift_c(R.get(m), SR_ASR, shift_n, xPSR.C);
+  R.set_lo(insn.d, result);
 
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_asr_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t shift_n = R.get(m) & Mask32<7, 0>;
+void CpuState::exec_asr_reg_t1(const Insn &insn) {
+  uint32_t shift_n = R.lo(insn.m) & Mask32<7, 0>;
   
-  auto &&[result, carry] = shift_c(R.get(n), SR_ASR, shift_n, xPSR.C);
+  auto &&[result, carry] = shift_c(R.lo(insn.n), SR_ASR, shift_n, xPSR.C());
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
   
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_svc_t1(uint32_t inst);
-static void exec_udf_t1(uint32_t inst);
 
-static void exec_b_t1(uint32_t inst) {
-  uint32_t cond = DINST(inst, 11, 8);
-  if (cond == 0b1110) {
-    exec_udf_t1(inst);
+void CpuState::exec_b_t1(const Insn &insn) {
+  if (insn.cond == 0b1110) {
+    exec_udf_t1(insn);
     return;
   }
-  if (cond == 0b1111) {
-    exec_svc_t1(inst);
+  if (insn.cond == 0b1111) {
+    exec_svc_t1(insn);
     return;
   }
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = SEXT32(imm8 << 1, 9);
 
-  if (condition_passed(cond)) {
-    branch_write_pc(R.get(PC) + imm32);
+  if (condition_passed(insn.cond)) {
+    branches_taken += 1;
+    branch_write_pc(R.get(PC) + insn.imm);
+  } else {
+    branches_not_taken += 1;
   }
 }
 
-static void exec_b_t2(uint32_t inst) {
-  uint32_t imm11 = DINST(inst, 10, 0);
-  uint32_t imm32 = SEXT32(imm11 << 1, 12);
-
-  branch_write_pc(R.get(PC) + imm32);
+void CpuState::exec_b_t2(const Insn &insn) {
+  branch_write_pc(R.get(PC) + insn.imm);
 }
 
-static void exec_bic_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t result = R.get(n) & (~R.get(m));
+void CpuState::exec_bic_reg_t1(const Insn &insn) {
+  uint32_t result = R.lo(insn.n) & (~R.lo(insn.m));
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  xPSR.set_nz(result);
 }
 
-static void exec_bkpt_t1(uint32_t inst) {
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
+void CpuState::exec_bkpt_t1(const Insn &insn) {
   bkpt_instr_debug_event();
 }
 
-static void exec_bl_t1(uint32_t inst) {
-  uint32_t S = DINST(inst, 10 + 16, 10 + 16);
-  uint32_t imm10 = DINST(inst, 9 + 16, 0 + 16);
-  uint32_t J1 = DINST(inst, 13, 13);
-  uint32_t J2 = DINST(inst, 11, 11);
-  uint32_t imm11 = DINST(inst, 10, 0);
-  uint32_t I1 = !(J1 ^ S);
-  uint32_t I2 = !(J2 ^ S);
-  uint32_t _imm_ = (S << 24) | (I2 << 23) | (I2 << 22) | (imm10 << 12) | (imm11 << 1);
-  uint32_t imm32 = SEXT32(_imm_, 25);
-
+void CpuState::exec_bl_t1(const Insn &insn) {
   uint32_t next_instr_addr = R.get(PC);
   R.set(LR, next_instr_addr | 0x1);
-  branch_write_pc(R.get(PC) + imm32);
+  if (profiler)
+    profiler->call(R.get(PC) + insn.imm, next_instr_addr);
+  branch_write_pc(R.get(PC) + insn.imm);
 }
 
-static void exec_blx_reg_t1(uint32_t inst) {
-  uint32_t m = DINST(inst, 6, 3);
+void CpuState::exec_blx_reg_t1(const Insn &insn) {
+  uint32_t m = insn.m;
   
   if (m == 15)
     panic("unpredictable");
@@ -915,63 +1117,37 @@ static void exec_blx_reg_t1(uint32_t inst) {
   uint32_t target = R.get(m);
   uint32_t next_instr_addr = R.get(PC) - 2;
   R.set(LR, next_instr_addr | 0x1);
+  if (profiler)
+    profiler->call(target, next_instr_addr);
   blx_write_pc(target);
 }
 
-static void exec_bx_t1(uint32_t inst) {
-  uint32_t m = DINST(inst, 6, 3);
+void CpuState::exec_bx_t1(const Insn &insn) {
+  uint32_t m = insn.m;
   
   if (m == 15)
     panic("unpredictable");
   
+  if (profiler)
+    profiler->ret(R.get(m));
   bx_write_pc(R.get(m));
 }
 
-static void exec_cmn_reg_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), R.get(m), false);
-  auto &&[carry, overflow] = bols;
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+void CpuState::exec_cmn_reg_t1(const Insn &insn) {
+  add_with_flags(R.lo(insn.n), R.lo(insn.m), false);
 }
 
-static void exec_cmp_imm_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
-  auto &&[result, bols] = add_with_carry(R.get(n), ~imm32, true);
-  auto &&[carry, overflow] = bols;
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+void CpuState::exec_cmp_imm_t1(const Insn &insn) {
+  add_with_flags(R.lo(insn.n), ~insn.imm, true);
 }
 
-static void exec_cmp_reg_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), ~R.get(m), true);
-  auto &&[carry, overflow] = bols;
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+void CpuState::exec_cmp_reg_t1(const Insn &insn) {
+  add_with_flags(R.lo(insn.n), ~R.lo(insn.m), true);
 }
 
-static void exec_cmp_reg_t2(uint32_t inst) {
-  uint32_t Rn = DINST(inst, 2, 0);
-  uint32_t N = DINST(inst, 7, 7);
-  uint32_t n = (N << 3) | Rn;
-  uint32_t m = DINST(inst, 6, 3);
+void CpuState::exec_cmp_reg_t2(const Insn &insn) {
+  uint32_t n = insn.n;
+  uint32_t m = insn.m;
 
   if (n < 8 && m < 8)
     panic("unpredictable");
@@ -979,57 +1155,40 @@ static void exec_cmp_reg_t2(uint32_t inst) {
   if (n == 15 || m == 15)
     panic("unpredictable");
 
-  auto &&[result, bols] = add_with_carry(R.get(n), ~R.get(m), true);
-  auto &&[carry, overflow] = bols;
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  add_with_flags(R.get(n), ~R.get(m), true);
 }
 
-static void exec_cps_t1(uint32_t inst) {
-  uint32_t im = DINST(inst, 4, 4);
-
+void CpuState::exec_cps_t1(const Insn &insn) {
   if (current_mode_is_privileged()) {
-    PMASK.PRIMASK = im;
+    PMASK.PRIMASK = insn.imm;
+    if (nvic)
+      nvic->changed();
   }
 }
 
-static void exec_dmb_t1(uint32_t inst) {
-  uint32_t option = DINST(inst, 3, 0);
-
-  data_memory_barrier(option);
+void CpuState::exec_dmb_t1(const Insn &insn) {
+  data_memory_barrier(insn.imm);
 }
 
-static void exec_dsb_t1(uint32_t inst) {
-  uint32_t option = DINST(inst, 3, 0);
-
-  data_synchronization_barrier(option);
+void CpuState::exec_dsb_t1(const Insn &insn) {
+  data_synchronization_barrier(insn.imm);
 }
 
-static void exec_eor_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t result = R.get(n) ^ R.get(m);
+void CpuState::exec_eor_reg_t1(const Insn &insn) {
+  uint32_t result = R.lo(insn.n) ^ R.lo(insn.m);
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  xPSR.set_nz(result);
 }
 
-static void exec_isb_t1(uint32_t inst) {
-  uint32_t option = DINST(inst, 3, 0);
-
-  instruction_synchronization_barrier(option);
+void CpuState::exec_isb_t1(const Insn &insn) {
+  instruction_synchronization_barrier(insn.imm);
 }
 
-static void exec_ldm_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 10, 8);
-  uint32_t regs = DINST(inst, 7, 0);
+void CpuState::exec_ldm_t1(const Insn &insn) {
+  uint32_t n = insn.n;
+  uint32_t regs = insn.imm;
   bool wback = !!((regs & (1 << n)) == 0);
   
   if (regs == 0)
@@ -1048,245 +1207,205 @@ static void exec_ldm_t1(uint32_t inst) {
     R.set(n, R.get(n) + 4 * bit_count(regs));
 }
 
-static void exec_ldr_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5 << 2;
-
-  uint32_t address = R.get(n) + imm32;
-  R.set(t, mem_access_aligned(address, 4));
+void CpuState::exec_ldr_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  R.set_lo(insn.d, mem_access_aligned(address, 4));
 }
 
-static void exec_ldr_imm_t2(uint32_t inst) {
-  uint32_t t = DINST(inst, 10, 8);
-  uint32_t n = 13;
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8 << 2;
-
-  uint32_t address = R.get(n) + imm32;
-  R.set(t, mem_access_aligned(address, 4));
+void CpuState::exec_ldr_imm_t2(const Insn &insn) {
+  uint32_t address = R.get(SP) + insn.imm;
+  R.set_lo(insn.d, mem_access_aligned(address, 4));
 }
 
-static void exec_ldr_lit_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8 << 2;
-
+void CpuState::exec_ldr_lit_t1(const Insn &insn) {
   uint32_t base = ALIGN(R.get(PC), 4);
-  uint32_t address = base + imm32;
-  R.set(t, mem_access_aligned(address, 4));
+  uint32_t address = base + insn.imm;
+  R.set_lo(insn.d, mem_access_aligned(address, 4));
 }
 
-static void exec_ldr_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  R.set(t, mem_access_aligned(address, 4));
+void CpuState::exec_ldr_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  R.set_lo(insn.d, mem_access_aligned(address, 4));
 }
 
-static void exec_ldrb_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5;
-
-  uint32_t address = R.get(n) + imm32;
-  R.set(t, mem_access_aligned(address, 1));
+void CpuState::exec_ldrb_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  R.set_lo(insn.d, mem_access_aligned(address, 1));
 }
 
-static void exec_ldrb_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  R.set(t, mem_access_aligned(address, 1));
+void CpuState::exec_ldrb_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  R.set_lo(insn.d, mem_access_aligned(address, 1));
 }
 
-static void exec_ldrh_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5 << 1;
-
-  uint32_t address = R.get(n) + imm32;
-  R.set(t, mem_access_aligned(address, 2));
+void CpuState::exec_ldrh_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  R.set_lo(insn.d, mem_access_aligned(address, 2));
 }
 
-static void exec_ldrh_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  R.set(t, mem_access_aligned(address, 2));
+void CpuState::exec_ldrh_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  R.set_lo(insn.d, mem_access_aligned(address, 2));
 }
 
-static void exec_ldrsb_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  R.set(t, SEXT32(mem_access_aligned(address, 1), 8));
+void CpuState::exec_ldrsb_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  R.set_lo(insn.d, SEXT32(mem_access_aligned(address, 1), 8));
 }
 
-static void exec_ldrsh_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  R.set(t, SEXT32(mem_access_aligned(address, 2), 16));
+void CpuState::exec_ldrsh_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  R.set_lo(insn.d, SEXT32(mem_access_aligned(address, 2), 16));
 }
 
-static void exec_lsl_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  auto &&[_, shift_n] = decode_imm_shift(0b00, imm5);
-
-  auto &&[result, carry] = shift_c(R.get(m), SR_LSL, shift_n, xPSR.C);
+void CpuState::exec_lsl_imm_t1(const Insn &insn) {
+  auto &&[result, carry] = shift_c(R.lo(insn.m), SR_LSL, insn.imm, xPSR.C());
 
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_lsl_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t shift_n = R.get(m) & Mask32<7, 0>;
+void CpuState::exec_lsl_reg_t1(const Insn &insn) {
+  uint32_t shift_n = R.lo(insn.m) & Mask32<7, 0>;
   
-  auto &&[result, carry] = shift_c(R.get(n), SR_LSL, shift_n, xPSR.C);
+  auto &&[result, carry] = shift_c(R.lo(insn.n), SR_LSL, shift_n, xPSR.C());
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
   
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_lsr_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  auto &&[_, shift_n] = decode_imm_shift(0b01, imm5);
-
-  auto &&[result, carry] = shift_c(R.get(m), SR_LSR, shift_n, xPSR.C);
+void CpuState::exec_lsr_imm_t1(const Insn &insn) {
+  auto &&[result, carry] = shift_c(R.lo(insn.m), SR_LSR, insn.imm, xPSR.C());
 
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_lsr_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t shift_n = R.get(m) & Mask32<7, 0>;
+void CpuState::exec_lsr_reg_t1(const Insn &insn) {
+  uint32_t shift_n = R.lo(insn.m) & Mask32<7, 0>;
   
-  auto &&[result, carry] = shift_c(R.get(n), SR_LSR, shift_n, xPSR.C);
+  auto &&[result, carry] = shift_c(R.lo(insn.n), SR_LSR, shift_n, xPSR.C());
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
   
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_mov_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
-  uint32_t result = imm32;
-  R.set(d, result);
+void CpuState::exec_mov_imm_t1(const Insn &insn) {
+  uint32_t result = insn.imm;
+  R.set_lo(insn.d, result);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  xPSR.set_nz(result);
 }
 
-static void exec_mov_reg_t1(uint32_t inst) {
-  uint32_t D = DINST(inst, 7, 7);
-  uint32_t Rm = DINST(inst, 6, 3);
-  uint32_t Rd = DINST(inst, 2, 0);
-  uint32_t d = ((D << 3) | Rd);
-  uint32_t m = Rm;
-
-  uint32_t result = R.get(m);
-  if (d == 15) {
+void CpuState::exec_mov_reg_t1(const Insn &insn) {
+  uint32_t result = R.get(insn.m);
+  if (insn.d == 15) {
     alu_write_pc(result);
   } else {
-    R.set(d, result);
+    R.set(insn.d, result);
   }
 }
 
-static void exec_mov_reg_t2(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t result = R.get(m);
-  R.set(d, result);
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+void CpuState::exec_mov_reg_t2(const Insn &insn) {
+  uint32_t result = R.lo(insn.m);
+  R.set_lo(insn.d, result);
+  xPSR.set_nz(result);
 }
 
-static void exec_mrs_t1(uint32_t inst) { panic("not implemented"); }
+void CpuState::exec_mrs_t1(const Insn &insn) {
+  uint32_t d = insn.d;
+  uint32_t SYSm = insn.imm;
 
-static void exec_msr_reg_t1(uint32_t inst) { panic("not implemented"); }
+  if (d == 13 || d == 15)
+    panic("unpredictable");
 
-static void exec_mul_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 2, 0);
+  uint32_t value = 0;
+  switch (SYSm >> 3) {
+  case 0b00000:
+    // any mix of apsr, ipsr and the always zero epsr
+    if (SYSm & 1)
+      value |= xPSR.ISR_idx;
+    if (!(SYSm & 4))
+      value |= xPSR.apsr();
+    break;
+  case 0b00001:
+    if (SYSm == 8)
+      value = R.sp_main;
+    else if (SYSm == 9)
+      value = R.sp_process;
+    break;
+  case 0b00010:
+    if (SYSm == 16)
+      value = PMASK.PRIMASK;
+    else if (SYSm == 20)
+      value = CTRL.SPSEL << 1;
+    break;
+  }
+  R.set(d, value);
+}
 
-  uint64_t op1 = R.get(n); 
-  uint64_t op2 = R.get(m);
+void CpuState::exec_msr_reg_t1(const Insn &insn) {
+  uint32_t n = insn.n;
+  uint32_t SYSm = insn.imm;
 
-  uint64_t result = op1 * op2;
-  R.set(d, result);
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  if (n == 13 || n == 15)
+    panic("unpredictable");
+
+  uint32_t value = R.get(n);
+  switch (SYSm >> 3) {
+  case 0b00000:
+    if (!(SYSm & 4))
+      xPSR.set_apsr(value);
+    break;
+  case 0b00001:
+    if (SYSm == 8)
+      R.sp_main = value & Mask32<31, 2>;
+    else if (SYSm == 9)
+      R.sp_process = value & Mask32<31, 2>;
+    break;
+  case 0b00010:
+    if (SYSm == 16) {
+      PMASK.PRIMASK = value & 1;
+      if (nvic)
+        nvic->changed();
+    } else if (SYSm == 20 && mstatus == Mode_Thread) {
+      // the stack can only be switched in thread mode
+      CTRL.SPSEL = value >> 1 & 1;
+    }
+    break;
+  }
 }
 
-static void exec_mvn_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
+void CpuState::exec_mul_t1(const Insn &insn) {
+  uint64_t op1 = R.lo(insn.n); 
+  uint64_t op2 = R.lo(insn.m);
 
-  uint32_t result = ~R.get(m);
-  R.set(d, result);
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  uint64_t result = op1 * op2;
+  R.set_lo(insn.d, result);
+  xPSR.set_nz(result);
 }
 
-static void exec_nop_t1(uint32_t inst) {}
+void CpuState::exec_mvn_reg_t1(const Insn &insn) {
+  uint32_t result = ~R.lo(insn.m);
+  R.set_lo(insn.d, result);
+  xPSR.set_nz(result);
+}
 
-static void exec_orr_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
+void CpuState::exec_nop_t1(const Insn &insn) {}
 
-  uint32_t result = R.get(n) | R.get(m);
-  R.set(d, result);
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+void CpuState::exec_orr_reg_t1(const Insn &insn) {
+  uint32_t result = R.lo(insn.n) | R.lo(insn.m);
+  R.set_lo(insn.d, result);
+  xPSR.set_nz(result);
 }
 
-static void exec_pop_t1(uint32_t inst) {
-  uint32_t reglist = DINST(inst, 7, 0);
-  uint32_t P = DINST(inst, 8, 8);
-  uint32_t regs = (P << 15) | reglist;
+void CpuState::exec_pop_t1(const Insn &insn) {
+  uint32_t regs = insn.imm;
+  bool P = regs >> 15;
 
   if (regs == 0)
     panic("unpredictable");
@@ -1298,16 +1417,20 @@ static void exec_pop_t1(uint32_t inst) {
       address += 4;
     }
   }
-  if (P)
-    load_write_pc(mem_access_aligned(address, 4));
+  uint32_t target = P ? mem_access_aligned(address, 4) : 0;
 
+  // before pc, an exception return switches stacks
   R.set(SP, R.get(SP) + 4 * bit_count(regs));
+
+  if (P) {
+    if (profiler)
+      profiler->ret(target);
+    load_write_pc(target);
+  }
 }
 
-static void exec_push_t1(uint32_t inst) {
-  uint32_t reglist = DINST(inst, 7, 0);
-  uint32_t M = DINST(inst, 8, 8);
-  uint32_t regs = (M << 14) | reglist;
+void CpuState::exec_push_t1(const Insn &insn) {
+  uint32_t regs = insn.imm;
 
   if (regs == 0)
     panic("unpredictable");
@@ -1323,90 +1446,56 @@ static void exec_push_t1(uint32_t inst) {
   R.set(SP, R.get(SP) - 4 * bit_count(regs));
 }
 
-static void exec_rev_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t word = R.get(m);
+void CpuState::exec_rev_t1(const Insn &insn) {
+  uint32_t word = R.lo(insn.m);
   uint32_t result = ((word & Mask32< 7,  0>) << 24) |
                     ((word & Mask32<15,  8>) <<  8) |
                     ((word & Mask32<23, 16>) >>  8) |
                     ((word & Mask32<31, 24>) >> 24);
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_rev16_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t word = R.get(m);
+void CpuState::exec_rev16_t1(const Insn &insn) {
+  uint32_t word = R.lo(insn.m);
   uint32_t result = ((word & Mask32<23, 16>) <<  8) |
                     ((word & Mask32<31, 24>) >>  8) |
                     ((word & Mask32< 7,  0>) <<  8) |
                     ((word & Mask32<15,  8>) >>  8);
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_revsh_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t word = R.get(m);
+void CpuState::exec_revsh_t1(const Insn &insn) {
+  uint32_t word = R.lo(insn.m);
   uint32_t result = ((SEXT32((word & Mask32<7, 0>), 8) & Mask32<23, 0>) << 8) |
                     ((word & Mask32<15,  8>) >>  8);
-  R.set(d, result);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_ror_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t shift_n = R.get(m) & Mask32<7, 0>;
+void CpuState::exec_ror_reg_t1(const Insn &insn) {
+  uint32_t shift_n = R.lo(insn.m) & Mask32<7, 0>;
   
-  auto &&[result, carry] = shift_c(R.get(n), SR_ROR, shift_n, xPSR.C);
+  auto &&[result, carry] = shift_c(R.lo(insn.n), SR_ROR, shift_n, xPSR.C());
   
-  R.set(d, result);
+  R.set_lo(insn.d, result);
   
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
+  xPSR.set_nzc(result, carry);
 }
 
-static void exec_rsb_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-
-  auto &&[result, bols] = add_with_carry(~R.get(n), 0, true);
-  auto &&[carry, overflow] = bols;
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+void CpuState::exec_rsb_imm_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(~R.lo(insn.n), 0, true);
+  R.set_lo(insn.d, result);
 }
 
-static void exec_sbc_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), ~R.get(m), xPSR.C);
-  auto &&[carry, overflow] = bols;
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+void CpuState::exec_sbc_reg_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), ~R.lo(insn.m), xPSR.C());
+  R.set_lo(insn.d, result);
 }
 
-static void exec_sev_t1(uint32_t inst) { hint_send_event(); }
+void CpuState::exec_sev_t1(const Insn &insn) { hint_send_event(); }
 
-static void exec_stm_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 10, 8);
-  uint32_t regs = DINST(inst, 7, 0);
+void CpuState::exec_stm_t1(const Insn &insn) {
+  uint32_t n = insn.n;
+  uint32_t regs = insn.imm;
   
   if (regs == 0)
     panic("unpredictable");
@@ -1423,188 +1512,100 @@ static void exec_stm_t1(uint32_t inst) {
   R.set(n, R.get(n) + 4 * bit_count(regs));
 }
 
-static void exec_str_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5 << 2;
-
-  uint32_t address = R.get(n) + imm32;
-  mem_modify_aligned(R.get(t), address, 4);
+void CpuState::exec_str_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  mem_modify_aligned(R.lo(insn.d), address, 4);
 }
 
-static void exec_str_imm_t2(uint32_t inst) {
-  uint32_t t = DINST(inst, 10, 8);
-  uint32_t n = 13;
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8 << 2;
-
-  uint32_t address = R.get(n) + imm32;
-  mem_modify_aligned(R.get(t), address, 4);
+void CpuState::exec_str_imm_t2(const Insn &insn) {
+  uint32_t address = R.get(SP) + insn.imm;
+  mem_modify_aligned(R.lo(insn.d), address, 4);
 }
 
-static void exec_str_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  mem_modify_aligned(R.get(t), address, 4);
+void CpuState::exec_str_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  mem_modify_aligned(R.lo(insn.d), address, 4);
 }
 
-static void exec_strb_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5;
-
-  uint32_t address = R.get(n) + imm32;
-  mem_modify_aligned(R.get(t), address, 1);
+void CpuState::exec_strb_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  mem_modify_aligned(R.lo(insn.d), address, 1);
 }
 
-static void exec_strb_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  mem_modify_aligned(R.get(t), address, 1);
+void CpuState::exec_strb_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  mem_modify_aligned(R.lo(insn.d), address, 1);
 }
 
-static void exec_strh_imm_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm5 = DINST(inst, 10, 6);
-  uint32_t imm32 = imm5;
-
-  uint32_t address = R.get(n) + imm32;
-  mem_modify_aligned(R.get(t), address, 2);
+void CpuState::exec_strh_imm_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + insn.imm;
+  mem_modify_aligned(R.lo(insn.d), address, 2);
 }
 
-static void exec_strh_reg_t1(uint32_t inst) {
-  uint32_t t = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  uint32_t address = R.get(n) + R.get(m);
-  mem_modify_aligned(R.get(t), address, 2);
+void CpuState::exec_strh_reg_t1(const Insn &insn) {
+  uint32_t address = R.lo(insn.n) + R.lo(insn.m);
+  mem_modify_aligned(R.lo(insn.d), address, 2);
 }
 
-static void exec_sub_imm_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t imm3 = DINST(inst, 8, 6);
-  uint32_t imm32 = imm3;
+void CpuState::exec_sub_imm_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), ~insn.imm, true);
 
-  auto &&[result, bols] = add_with_carry(R.get(n), ~imm32, true);
-  auto &&[carry, overflow] = bols;
-
-  R.set(d, result);
-  
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_sub_imm_t2(uint32_t inst) {
-  uint32_t d = DINST(inst, 10, 8);
-  uint32_t n = DINST(inst, 10, 8);
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
-  auto &&[result, bols] = add_with_carry(R.get(n), ~imm32, true);
-  auto &&[carry, overflow] = bols;
+void CpuState::exec_sub_imm_t2(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), ~insn.imm, true);
   
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_sub_reg_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t n = DINST(inst, 5, 3);
-  uint32_t m = DINST(inst, 8, 6);
-
-  auto &&[result, bols] = add_with_carry(R.get(n), ~R.get(m), true);
-  auto &&[carry, overflow] = bols;
+void CpuState::exec_sub_reg_t1(const Insn &insn) {
+  uint32_t result = add_with_flags(R.lo(insn.n), ~R.lo(insn.m), true);
 
-  R.set(d, result);
-
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
-  xPSR.C = carry;
-  xPSR.V = overflow;
+  R.set_lo(insn.d, result);
 }
 
-static void exec_sub_sp_imm_t1(uint32_t inst) {
-  uint32_t d = 13;
-  uint32_t imm7 = DINST(inst, 6, 0);
-  uint32_t imm32 = imm7 << 2;
-
-  auto &&[result, _] = add_with_carry(R.get(SP), ~imm32, true);
+void CpuState::exec_sub_sp_imm_t1(const Insn &insn) {
+  auto &&[result, _] = add_with_carry(R.get(SP), ~insn.imm, true);
   
-  R.set(d, result);
+  R.set(SP, result);
 }
 
-static void exec_svc_t1(uint32_t inst) {
-  uint32_t imm8 = DINST(inst, 7, 0);
-  uint32_t imm32 = imm8;
-
-  R.set(LR, (R.inst_addr() + (isinst16 ? 2 : 4)) | 0x1);
+void CpuState::exec_svc_t1(const Insn &insn) {
   call_supervisor();
 }
 
-static void exec_sxtb_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  R.set(d, SEXT32((R.get(m) & Mask32<7, 0>), 8));
+void CpuState::exec_sxtb_t1(const Insn &insn) {
+  R.set_lo(insn.d, SEXT32((R.lo(insn.m) & Mask32<7, 0>), 8));
 }
 
-static void exec_sxth_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  R.set(d, SEXT32((R.get(m) & Mask32<15, 0>), 16));
+void CpuState::exec_sxth_t1(const Insn &insn) {
+  R.set_lo(insn.d, SEXT32((R.lo(insn.m) & Mask32<15, 0>), 16));
 }
 
-static void exec_tst_reg_t1(uint32_t inst) {
-  uint32_t n = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  uint32_t result = R.get(n) & R.get(m);
+void CpuState::exec_tst_reg_t1(const Insn &insn) {
+  uint32_t result = R.lo(insn.n) & R.lo(insn.m);
 
-  xPSR.N = !!(result & Mask32<31, 31>);
-  xPSR.Z = is_zero(result);
+  xPSR.set_nz(result);
 }
 
-static void exec_udf_t1(uint32_t inst) {
+void CpuState::exec_udf_t1(const Insn &insn) {
   panic("undefined");
 }
 
-static void exec_udf_t2(uint32_t inst) {
+void CpuState::exec_udf_t2(const Insn &insn) {
   panic("undefined");
 }
 
-static void exec_uxtb_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  R.set(d, R.get(m) & Mask32<7, 0>);
+void CpuState::exec_uxtb_t1(const Insn &insn) {
+  R.set_lo(insn.d, R.lo(insn.m) & Mask32<7, 0>);
 }
 
-static void exec_uxth_t1(uint32_t inst) {
-  uint32_t d = DINST(inst, 2, 0);
-  uint32_t m = DINST(inst, 5, 3);
-
-  R.set(d, R.get(m) & Mask32<15, 0>);
+void CpuState::exec_uxth_t1(const Insn &insn) {
+  R.set_lo(insn.d, R.lo(insn.m) & Mask32<15, 0>);
 }
 
-static void exec_wfe_t1(uint32_t inst) {
+void CpuState::exec_wfe_t1(const Insn &insn) {
   if (event_registered()) {
     clear_event_register();
   } else {
@@ -1612,118 +1613,131 @@ static void exec_wfe_t1(uint32_t inst) {
   }
 }
 
-static void exec_wfi_t1(uint32_t inst) { wait_for_interrupt(); }
+void CpuState::exec_wfi_t1(const Insn &insn) { wait_for_interrupt(); }
 
-static void exec_yield_t1(uint32_t inst) { hint_yield(); }
+void CpuState::exec_yield_t1(const Insn &insn) { hint_yield(); }
 
 
 //
 // ----- ----- Decoder ----- -----
 //
 
-static int cm0 = 0;
-
-Cortex_M0::Cortex_M0(SystemBus *bus) {
-  panicifnot(cm0 == 0);
-  cm0 += 1;
-
-  panicifnot(bus);
-  sysbus = bus;
-
-  dict.insert("000'00'00000'xxx'xxx",   exec_mov_reg_t2);
-  dict.insert("000'00'xxxxx'xxx'xxx",   exec_lsl_imm_t1);
-  dict.insert("000'01'xxxxx'xxx'xxx",   exec_lsr_imm_t1);
-  dict.insert("000'10'xxxxx'xxx'xxx",   exec_asr_imm_t1);
-  dict.insert("000'11'0'0'xxx'xxx'xxx", exec_add_reg_t1);
-  dict.insert("000'11'0'1'xxx'xxx'xxx", exec_sub_reg_t1);
-  dict.insert("000'11'1'0'xxx'xxx'xxx", exec_add_imm_t1);
-  dict.insert("000'11'1'1'xxx'xxx'xxx", exec_sub_imm_t1);
+Decoder::Decoder() {
+  insert("000'00'00000'xxx'xxx",   &CpuState::exec_mov_reg_t2);
+  insert("000'00'xxxxx'xxx'xxx",   &CpuState::exec_lsl_imm_t1);
+  insert("000'01'xxxxx'xxx'xxx",   &CpuState::exec_lsr_imm_t1);
+  insert("000'10'xxxxx'xxx'xxx",   &CpuState::exec_asr_imm_t1);
+  insert("000'11'0'0'xxx'xxx'xxx", &CpuState::exec_add_reg_t1);
+  insert("000'11'0'1'xxx'xxx'xxx", &CpuState::exec_sub_reg_t1);
+  insert("000'11'1'0'xxx'xxx'xxx", &CpuState::exec_add_imm_t1);
+  insert("000'11'1'1'xxx'xxx'xxx", &CpuState::exec_sub_imm_t1);
   
-  dict.insert("001'00'xxx'xxxxxxxx",    exec_mov_imm_t1);
-  dict.insert("001'01'xxx'xxxxxxxx",    exec_cmp_imm_t1);
-  dict.insert("001'10'xxx'xxxxxxxx",    exec_add_imm_t2);
-  dict.insert("001'11'xxx'xxxxxxxx",    exec_sub_imm_t2);
-
-  dict.insert("01001'xxx'xxxxxxxx",     exec_ldr_lit_t1);
-  dict.insert("011'0'0'xxxxx'xxx'xxx",  exec_str_imm_t1);
-  dict.insert("011'0'1'xxxxx'xxx'xxx",  exec_ldr_imm_t1);
-  dict.insert("011'1'0'xxxxx'xxx'xxx",  exec_strb_imm_t1);
-  dict.insert("011'1'1'xxxxx'xxx'xxx",  exec_ldrb_imm_t1);
+  insert("001'00'xxx'xxxxxxxx",    &CpuState::exec_mov_imm_t1);
+  insert("001'01'xxx'xxxxxxxx",    &CpuState::exec_cmp_imm_t1);
+  insert("001'10'xxx'xxxxxxxx",    &CpuState::exec_add_imm_t2);
+  insert("001'11'xxx'xxxxxxxx",    &CpuState::exec_sub_imm_t2);
+
+  insert("01001'xxx'xxxxxxxx",     &CpuState::exec_ldr_lit_t1);
+  insert("011'0'0'xxxxx'xxx'xxx",  &CpuState::exec_str_imm_t1);
+  insert("011'0'1'xxxxx'xxx'xxx",  &CpuState::exec_ldr_imm_t1);
+  insert("011'1'0'xxxxx'xxx'xxx",  &CpuState::exec_strb_imm_t1);
+  insert("011'1'1'xxxxx'xxx'xxx",  &CpuState::exec_ldrb_imm_t1);
   
-  dict.insert("010000'0000'xxx'xxx",    exec_and_reg_t1);
-  dict.insert("010000'0001'xxx'xxx",    exec_eor_reg_t1);
-  dict.insert("010000'0010'xxx'xxx",    exec_lsl_reg_t1);
-  dict.insert("010000'0011'xxx'xxx",    exec_lsr_reg_t1);
-  dict.insert("010000'0100'xxx'xxx",    exec_asr_reg_t1);
-  dict.insert("010000'0101'xxx'xxx",    exec_adc_reg_t1);
-  dict.insert("010000'0110'xxx'xxx",    exec_sbc_reg_t1);
-  dict.insert("010000'0111'xxx'xxx",    exec_ror_reg_t1);
-  dict.insert("010000'1000'xxx'xxx",    exec_tst_reg_t1);
-  dict.insert("010000'1001'xxx'xxx",    exec_rsb_imm_t1);
-  dict.insert("010000'1010'xxx'xxx",    exec_cmp_reg_t1);
-  dict.insert("010000'1011'xxx'xxx",    exec_cmn_reg_t1);
-  dict.insert("010000'1100'xxx'xxx",    exec_orr_reg_t1);
-  dict.insert("010000'1101'xxx'xxx",    exec_mul_t1);
-  dict.insert("010000'1110'xxx'xxx",    exec_bic_reg_t1);
-  dict.insert("010000'1111'xxx'xxx",    exec_mvn_reg_t1);
-
-//dict.insert("010001 00'x'1101'xxx",   exec_add_sp_reg_t1);
-//dict.insert("010001 00'1'xxxx'101",   exec_add_sp_reg_t2);
-  dict.insert("010001'00'x'xxxx'xxx",   exec_add_reg_t2);
-  dict.insert("010001'01'x'xxxx'xxx",   exec_cmp_reg_t2);
-  dict.insert("010001'10'x'xxxx'xxx",   exec_mov_reg_t1);
-  dict.insert("010001'11'1'xxxx'000",   exec_blx_reg_t1);
-  dict.insert("010001'11'0'xxxx'000",   exec_bx_t1);
+  insert("010000'0000'xxx'xxx",    &CpuState::exec_and_reg_t1);
+  insert("010000'0001'xxx'xxx",    &CpuState::exec_eor_reg_t1);
+  insert("010000'0010'xxx'xxx",    &CpuState::exec_lsl_reg_t1);
+  insert("010000'0011'xxx'xxx",    &CpuState::exec_lsr_reg_t1);
+  insert("010000'0100'xxx'xxx",    &CpuState::exec_asr_reg_t1);
+  insert("010000'0101'xxx'xxx",    &CpuState::exec_adc_reg_t1);
+  insert("010000'0110'xxx'xxx",    &CpuState::exec_sbc_reg_t1);
+  insert("010000'0111'xxx'xxx",    &CpuState::exec_ror_reg_t1);
+  insert("010000'1000'xxx'xxx",    &CpuState::exec_tst_reg_t1);
+  insert("010000'1001'xxx'xxx",    &CpuState::exec_rsb_imm_t1);
+  insert("010000'1010'xxx'xxx",    &CpuState::exec_cmp_reg_t1);
+  insert("010000'1011'xxx'xxx",    &CpuState::exec_cmn_reg_t1);
+  insert("010000'1100'xxx'xxx",    &CpuState::exec_orr_reg_t1);
+  insert("010000'1101'xxx'xxx",    &CpuState::exec_mul_t1);
+  insert("010000'1110'xxx'xxx",    &CpuState::exec_bic_reg_t1);
+  insert("010000'1111'xxx'xxx",    &CpuState::exec_mvn_reg_t1);
+
+//insert("010001 00'x'1101'xxx",   &CpuState::exec_add_sp_reg_t1);
+//insert("010001 00'1'xxxx'101",   &CpuState::exec_add_sp_reg_t2);
+  insert("010001'00'x'xxxx'xxx",   &CpuState::exec_add_reg_t2);
+  insert("010001'01'x'xxxx'xxx",   &CpuState::exec_cmp_reg_t2);
+  insert("010001'10'x'xxxx'xxx",   &CpuState::exec_mov_reg_t1);
+  insert("010001'11'1'xxxx'000",   &CpuState::exec_blx_reg_t1);
+  insert("010001'11'0'xxxx'000",   &CpuState::exec_bx_t1);
   
-  dict.insert("0101'000'xxx'xxx'xxx",   exec_str_reg_t1);
-  dict.insert("0101'001'xxx'xxx'xxx",   exec_strh_reg_t1);
-  dict.insert("0101'010'xxx'xxx'xxx",   exec_strb_reg_t1);
-  dict.insert("0101'011'xxx'xxx'xxx",   exec_ldrsb_reg_t1);
-  dict.insert("0101'100'xxx'xxx'xxx",   exec_ldr_reg_t1);
-  dict.insert("0101'101'xxx'xxx'xxx",   exec_ldrh_reg_t1);
-  dict.insert("0101'110'xxx'xxx'xxx",   exec_ldrb_reg_t1);
-  dict.insert("0101'111'xxx'xxx'xxx",   exec_ldrsh_reg_t1);
+  insert("0101'000'xxx'xxx'xxx",   &CpuState::exec_str_reg_t1);
+  insert("0101'001'xxx'xxx'xxx",   &CpuState::exec_strh_reg_t1);
+  insert("0101'010'xxx'xxx'xxx",   &CpuState::exec_strb_reg_t1);
+  insert("0101'011'xxx'xxx'xxx",   &CpuState::exec_ldrsb_reg_t1);
+  insert("0101'100'xxx'xxx'xxx",   &CpuState::exec_ldr_reg_t1);
+  insert("0101'101'xxx'xxx'xxx",   &CpuState::exec_ldrh_reg_t1);
+  insert("0101'110'xxx'xxx'xxx",   &CpuState::exec_ldrb_reg_t1);
+  insert("0101'111'xxx'xxx'xxx",   &CpuState::exec_ldrsh_reg_t1);
   
-  dict.insert("1000'0'xxxxx'xxx'xxx",   exec_strh_imm_t1);
-  dict.insert("1000'1'xxxxx'xxx'xxx",   exec_ldrh_imm_t1);
-  dict.insert("1001'0'xxx'xxxxxxxx",    exec_str_imm_t2);
-  dict.insert("1001'1'xxx'xxxxxxxx",    exec_ldr_imm_t2);
-  dict.insert("1010'0'xxx'xxxxxxxx",    exec_adr_t1);
-  dict.insert("1010'1'xxx'xxxxxxxx",    exec_add_sp_imm_t1);
-
-  dict.insert("1011'0'10'x'xxxx xxxx",    exec_push_t1);
-  dict.insert("1011'0 11 0'011'x'0'0'1'0",exec_cps_t1);
-  dict.insert("1011'0 00 0'1'xxxxxxx",    exec_sub_sp_imm_t1);
-  dict.insert("1011'0 00 0'0'xxxxxxx",    exec_add_sp_imm_t2);
-  dict.insert("1011'0 01 0'01'xxx'xxx",   exec_sxtb_t1);
-  dict.insert("1011'0 01 0'00'xxx'xxx",   exec_sxth_t1);
-  dict.insert("1011'0 01 0'11'xxx'xxx",   exec_uxtb_t1);
-  dict.insert("1011'0 01 0'10'xxx'xxx",   exec_uxth_t1);
-  dict.insert("1011'1 01 0'00'xxx'xxx",   exec_rev_t1);
-  dict.insert("1011'1 01 0'01'xxx'xxx",   exec_rev16_t1);
-  dict.insert("1011'1 01 0'11'xxx'xxx",   exec_revsh_t1);
-  dict.insert("1011'1'10'x'xxxx xxxx",    exec_pop_t1);
-  dict.insert("1011'1 11 0'xxxxxxxx",     exec_bkpt_t1);
-  dict.insert("1011'1 11 1'0000'0000",    exec_nop_t1);
-  dict.insert("1011'1 11 1'0100'0000",    exec_sev_t1);
-  dict.insert("1011'1 11 1'0010'0000",    exec_wfe_t1);
-  dict.insert("1011'1 11 1'0011'0000",    exec_wfi_t1);
-  dict.insert("1011'1 11 1'0001'0000",    exec_yield_t1);
-
-  dict.insert("1100'0'xxx'xxxxxxxx",  exec_stm_t1);
-  dict.insert("1100'1'xxx'xxxxxxxx",  exec_ldm_t1);
-  dict.insert("1101'xxxx'xxxxxxxx",   exec_b_t1);
-//dict.insert("1101'1111'xxxxxxxx",   exec_svc_t1);
-//dict.insert("1101'1110'xxxxxxxx",   exec_udf_t1);
-  dict.insert("1110 0'xxxxxxxxxxx",   exec_b_t2);
+  insert("1000'0'xxxxx'xxx'xxx",   &CpuState::exec_strh_imm_t1);
+  insert("1000'1'xxxxx'xxx'xxx",   &CpuState::exec_ldrh_imm_t1);
+  insert("1001'0'xxx'xxxxxxxx",    &CpuState::exec_str_imm_t2);
+  insert("1001'1'xxx'xxxxxxxx",    &CpuState::exec_ldr_imm_t2);
+  insert("1010'0'xxx'xxxxxxxx",    &CpuState::exec_adr_t1);
+  insert("1010'1'xxx'xxxxxxxx",    &CpuState::exec_add_sp_imm_t1);
+
+  insert("1011'0'10'x'xxxx xxxx",    &CpuState::exec_push_t1);
+  insert("1011'0 11 0'011'x'0'0'1'0",&CpuState::exec_cps_t1);
+  insert("1011'0 00 0'1'xxxxxxx",    &CpuState::exec_sub_sp_imm_t1);
+  insert("1011'0 00 0'0'xxxxxxx",    &CpuState::exec_add_sp_imm_t2);
+  insert("1011'0 01 0'01'xxx'xxx",   &CpuState::exec_sxtb_t1);
+  insert("1011'0 01 0'00'xxx'xxx",   &CpuState::exec_sxth_t1);
+  insert("1011'0 01 0'11'xxx'xxx",   &CpuState::exec_uxtb_t1);
+  insert("1011'0 01 0'10'xxx'xxx",   &CpuState::exec_uxth_t1);
+  insert("1011'1 01 0'00'xxx'xxx",   &CpuState::exec_rev_t1);
+  insert("1011'1 01 0'01'xxx'xxx",   &CpuState::exec_rev16_t1);
+  insert("1011'1 01 0'11'xxx'xxx",   &CpuState::exec_revsh_t1);
+  insert("1011'1'10'x'xxxx xxxx",    &CpuState::exec_pop_t1);
+  insert("1011'1 11 0'xxxxxxxx",     &CpuState::exec_bkpt_t1);
+  insert("1011'1 11 1'0000'0000",    &CpuState::exec_nop_t1);
+  insert("1011'1 11 1'0100'0000",    &CpuState::exec_sev_t1);
+  insert("1011'1 11 1'0010'0000",    &CpuState::exec_wfe_t1);
+  insert("1011'1 11 1'0011'0000",    &CpuState::exec_wfi_t1);
+  insert("1011'1 11 1'0001'0000",    &CpuState::exec_yield_t1);
+
+  insert("1100'0'xxx'xxxxxxxx",  &CpuState::exec_stm_t1);
+  insert("1100'1'xxx'xxxxxxxx",  &CpuState::exec_ldm_t1);
+  insert("1101'xxxx'xxxxxxxx",   &CpuState::exec_b_t1);
+//insert("1101'1111'xxxxxxxx",   &CpuState::exec_svc_t1);
+//insert("1101'1110'xxxxxxxx",   &CpuState::exec_udf_t1);
+  insert("1110 0'xxxxxxxxxxx",   &CpuState::exec_b_t2);
   
-  dict.insert("111 10'0'111 0'0'0'xxxx'1 0'0'0'1'0'0'0'xxxx xxxx",  exec_msr_reg_t1);
-  dict.insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0101'xxxx",  exec_dmb_t1);
-  dict.insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0100'xxxx",  exec_dsb_t1);
-  dict.insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0110'xxxx",  exec_isb_t1);
-  dict.insert("111 10'0'111 1'1'0'1111'1 0'0'0'x x x x'xxxx xxxx",  exec_mrs_t1);
-  dict.insert("111'10'1 111 1 1 1'xxxx'1'0 1 0'x x x x xxxx xxxx",  exec_udf_t2);
-  dict.insert("111 10'x'xxx x x x xxxx'1 1'x'1'x'x x x xxxx xxxx",  exec_bl_t1);
+  insert("111 10'0'111 0'0'0'xxxx'1 0'0'0'1'0'0'0'xxxx xxxx",  &CpuState::exec_msr_reg_t1);
+  insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0101'xxxx",  &CpuState::exec_dmb_t1);
+  insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0100'xxxx",  &CpuState::exec_dsb_t1);
+  insert("111 10'0'111'0 1'1'1111'1 0'0'0'1 1 1 1'0110'xxxx",  &CpuState::exec_isb_t1);
+  insert("111 10'0'111 1'1'0'1111'1 0'0'0'x x x x'xxxx xxxx",  &CpuState::exec_mrs_t1);
+  insert("111'10'1 111 1 1 1'xxxx'1'0 1 0'x x x x xxxx xxxx",  &CpuState::exec_udf_t2);
+  insert("111 10'x'xxx x x x xxxx'1 1'x'1'x'x x x xxxx xxxx",  &CpuState::exec_bl_t1);
+}
+
+//
+// ----- ----- Reset ----- -----
+//
+
+static Translator *jit_init(CpuState &cpu);
+
+CpuState::CpuState(SystemBus *bus, Nvic *nvic, const CpuOptions &opts)
+    : sysbus(bus), nvic(nvic), trace(opts.trace), cpi(opts.cpi),
+      idleskip(opts.idleskip) {
+  panicifnot(bus && cpi);
+
+  if (opts.tracefile)
+    tracefile = new etrace::Writer(opts.tracefile);
+  tracing = trace || tracefile;
+
+  if (trace) {
+    dbgr.setqlen(100);
+    dbgr.arm();
+  }
 
   uint32_t interp_msp;
   uint32_t interp_rst;
@@ -1731,54 +1745,1201 @@ Cortex_M0::Cortex_M0(SystemBus *bus) {
   sysbus->read32(interp_msp, IMG_ADDR + 0x0);
   sysbus->read32(interp_rst, IMG_ADDR + 0x4);
 
-  mstatus = Mode_Handler;
+  mstatus = Mode_Thread;
   CTRL.SPSEL = 0;
   R.set(SP, interp_msp);
   branch_write_pc(interp_rst);
   nojmp = true;
 
-  dbgr.setqlen(100);
+  // the reset handler is the root frame and never returns
+  if (opts.profelf) {
+    profiler = new Profiler(opts.profelf, opts.profperiod);
+    profiler->call(interp_rst, ~0u);
+    profout = opts.profout;
+  }
+
+  // translated blocks skip the trace hooks
+  if (opts.jit && tracing)
+    fprintf(stderr, "jit is off while tracing, using the interpreter\n");
+  else if (opts.jit)
+    translator = jit_init(*this);
 }
 
-static void decode_and_exec(uint32_t inst) {
-  isinst16 = (DINST(inst, 31, 27) == 0b11110) ? false : true;
-  inst = isinst16 ? inst >> 16 : inst;
-  auto exec = dict.search(inst, isinst16 ? 16 : 32);
-  panicifnot(exec);
+//
+// ----- ----- Block cache ----- -----
+//
+
+static bool ends_block(const Insn &insn) {
+  exectype exec = insn.exec;
+  if (exec == &CpuState::exec_pop_t1)
+    return insn.imm >> PC & 1;
+  if (exec == &CpuState::exec_mov_reg_t1 ||
+      exec == &CpuState::exec_add_reg_t2)
+    return insn.d == PC;
+
+  return exec == &CpuState::exec_b_t1 || exec == &CpuState::exec_b_t2 ||
+         exec == &CpuState::exec_bl_t1 || exec == &CpuState::exec_blx_reg_t1 ||
+         exec == &CpuState::exec_bx_t1 || exec == &CpuState::exec_svc_t1 ||
+         exec == &CpuState::exec_bkpt_t1 || exec == &CpuState::exec_cps_t1 ||
+         exec == &CpuState::exec_udf_t1 || exec == &CpuState::exec_udf_t2 ||
+         exec == &CpuState::exec_msr_reg_t1 || exec == &CpuState::exec_wfe_t1 ||
+         exec == &CpuState::exec_wfi_t1 || exec == &CpuState::exec_yield_t1;
+}
+
+static const exectype handlers[] = {
+#define X(name) &CpuState::exec_##name,
+  CM0_HANDLERS(X)
+#undef X
+};
+
+static const char *const handler_names[] = {
+#define X(name) "exec_" #name,
+  CM0_HANDLERS(X)
+#undef X
+};
 
+static uint32_t handler_id(exectype exec) {
+  for (size_t i = 0; i < std::size(handlers); ++i)
+    if (handlers[i] == exec)
+      return i;
+  panic("unreachable");
+  return 0;
+}
+
+enum HandlerId {
+#define X(name) H_##name,
+  CM0_HANDLERS(X)
+#undef X
+};
+
+// pulls the register numbers and immediates out of insn.inst once, when its
+// block is decoded, so the handlers never touch the encoding. Immediates are
+// scaled and sign extended here already.
+static void decode_operands(Insn &insn) {
+  uint32_t inst = insn.inst;
+  insn.d = insn.n = insn.m = insn.cond = 0;
+  insn.imm = 0;
+
+  switch (insn.id) {
+  // d, n, m in the low three fields
+  case H_add_reg_t1: case H_sub_reg_t1: case H_ldr_reg_t1: case H_ldrb_reg_t1:
+  case H_ldrh_reg_t1: case H_ldrsb_reg_t1: case H_ldrsh_reg_t1:
+  case H_str_reg_t1: case H_strb_reg_t1: case H_strh_reg_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    insn.m = DINST(inst, 8, 6);
+    break;
+  case H_add_imm_t1: case H_sub_imm_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    insn.imm = DINST(inst, 8, 6);
+    break;
+  // two register data processing, dn and m
+  case H_adc_reg_t1: case H_and_reg_t1: case H_asr_reg_t1: case H_bic_reg_t1:
+  case H_cmn_reg_t1: case H_cmp_reg_t1: case H_eor_reg_t1: case H_lsl_reg_t1:
+  case H_lsr_reg_t1: case H_orr_reg_t1: case H_ror_reg_t1: case H_sbc_reg_t1:
+  case H_tst_reg_t1:
+    insn.d = insn.n = DINST(inst, 2, 0);
+    insn.m = DINST(inst, 5, 3);
+    break;
+  case H_mul_t1:
+    insn.d = insn.m = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    break;
+  case H_mov_reg_t2: case H_mvn_reg_t1: case H_rev_t1: case H_rev16_t1:
+  case H_revsh_t1: case H_rsb_imm_t1: case H_sxtb_t1: case H_sxth_t1:
+  case H_uxtb_t1: case H_uxth_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = insn.m = DINST(inst, 5, 3);
+    break;
+  case H_lsl_imm_t1: case H_lsr_imm_t1: case H_asr_imm_t1: {
+    uint32_t type = insn.id == H_lsl_imm_t1 ? 0b00 : insn.id == H_lsr_imm_t1 ? 0b01 : 0b10;
+    auto &&[_, shift_n] = decode_imm_shift(type, DINST(inst, 10, 6));
+    insn.d = DINST(inst, 2, 0);
+    insn.m = DINST(inst, 5, 3);
+    insn.imm = shift_n;
+    break;
+  }
+  case H_ldr_imm_t1: case H_str_imm_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    insn.imm = DINST(inst, 10, 6) << 2;
+    break;
+  case H_ldrh_imm_t1: case H_strh_imm_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    insn.imm = DINST(inst, 10, 6) << 1;
+    break;
+  case H_ldrb_imm_t1: case H_strb_imm_t1:
+    insn.d = DINST(inst, 2, 0);
+    insn.n = DINST(inst, 5, 3);
+    insn.imm = DINST(inst, 10, 6);
+    break;
+  // a register in 10:8 and imm8
+  case H_add_imm_t2: case H_sub_imm_t2: case H_cmp_imm_t1: case H_mov_imm_t1:
+    insn.d = insn.n = DINST(inst, 10, 8);
+    insn.imm = DINST(inst, 7, 0);
+    break;
+  case H_add_sp_imm_t1: case H_adr_t1: case H_ldr_imm_t2: case H_ldr_lit_t1:
+  case H_str_imm_t2:
+    insn.d = DINST(inst, 10, 8);
+    insn.n = insn.id == H_ldr_imm_t2 || insn.id == H_str_imm_t2 ? SP : 0;
+    insn.imm = DINST(inst, 7, 0) << 2;
+    break;
+  case H_ldm_t1: case H_stm_t1:
+    insn.n = DINST(inst, 10, 8);
+    insn.imm = DINST(inst, 7, 0);
+    break;
+  case H_add_sp_imm_t2: case H_sub_sp_imm_t1:
+    insn.d = SP;
+    insn.imm = DINST(inst, 6, 0) << 2;
+    break;
+  // high registers
+  case H_add_reg_t2: case H_mov_reg_t1: case H_cmp_reg_t2:
+  case H_add_sp_reg_t1: case H_add_sp_reg_t2:
+    insn.d = insn.n = (DINST(inst, 7, 7) << 3) | DINST(inst, 2, 0);
+    insn.m = DINST(inst, 6, 3);
+    if (insn.id == H_add_sp_reg_t1)
+      insn.m = insn.d;
+    else if (insn.id == H_add_sp_reg_t2)
+      insn.d = SP;
+    break;
+  case H_bx_t1: case H_blx_reg_t1:
+    insn.m = DINST(inst, 6, 3);
+    break;
+  case H_push_t1:
+    insn.imm = (DINST(inst, 8, 8) << 14) | DINST(inst, 7, 0);
+    break;
+  case H_pop_t1:
+    insn.imm = (DINST(inst, 8, 8) << 15) | DINST(inst, 7, 0);
+    break;
+  case H_b_t1:
+    insn.cond = DINST(inst, 11, 8);
+    insn.imm = SEXT32(DINST(inst, 7, 0) << 1, 9);
+    break;
+  case H_b_t2:
+    insn.imm = SEXT32(DINST(inst, 10, 0) << 1, 12);
+    break;
+  case H_bl_t1: {
+    uint32_t S = DINST(inst, 10 + 16, 10 + 16);
+    uint32_t imm10 = DINST(inst, 9 + 16, 0 + 16);
+    uint32_t J1 = DINST(inst, 13, 13);
+    uint32_t J2 = DINST(inst, 11, 11);
+    uint32_t imm11 = DINST(inst, 10, 0);
+    uint32_t I1 = !(J1 ^ S);
+    uint32_t I2 = !(J2 ^ S);
+    uint32_t _imm_ = (S << 24) | (I1 << 23) | (I2 << 22) | (imm10 << 12) | (imm11 << 1);
+    insn.imm = SEXT32(_imm_, 25);
+    break;
+  }
+  case H_mrs_t1:
+    insn.d = DINST(inst, 11, 8);
+    insn.imm = DINST(inst, 7, 0);
+    break;
+  case H_msr_reg_t1:
+    insn.n = DINST(inst, 19, 16);
+    insn.imm = DINST(inst, 7, 0);
+    break;
+  case H_cps_t1:
+    insn.imm = DINST(inst, 4, 4);
+    break;
+  case H_dmb_t1: case H_dsb_t1: case H_isb_t1:
+    insn.imm = DINST(inst, 3, 0);
+    break;
+  case H_bkpt_t1: case H_svc_t1:
+    insn.imm = DINST(inst, 7, 0);
+    break;
+  default:
+    break;
+  }
+}
+
+#ifdef THREADED_DISPATCH
+
+static void *const *labels = nullptr;
+
+void *CpuState::threaded_label(exectype exec) {
+  static std::once_flag once;
+  std::call_once(once, [this] { run_threaded(nullptr, 0); });
+  return labels[handler_id(exec)];
+}
+
+#endif
+
+Block &CpuState::fetch_block(uint32_t addr) {
+  Block &blk = blocks[(addr >> 1) & (NR_BLOCKS - 1)];
+  if (blk.addr == addr)
+    return blk;
+
+  // the old instructions are about to go, count their runs first
+  for (uint32_t i = 0; i < blk.len; ++i)
+    handler_counts[blk.insts[i].id] += blk.runs;
+  blk.runs = 0;
+
+  blk.addr = addr;
+  blk.len = 0;
+  blk.hits = 0;
+  blk.code = nullptr;
+
+  uint32_t pc = addr;
+  while (blk.len < BLOCK_INSTS) {
+    uint16_t loinst = 0;
+    uint16_t hiinst = 0;
+    sysbus->read16(loinst, pc);
+    uint32_t inst = loinst;
+    bool is16 = DINST(inst, 15, 11) != 0b11110;
+    if (!is16) {
+      sysbus->read16(hiinst, pc + 2);
+      inst = (inst << 16) | hiinst;
+    }
+
+    auto exec = dict.search(inst, is16 ? 16 : 32);
+    if (!exec)
+      break;
+
+    Insn &insn = blk.insts[blk.len++];
+    insn = {exec, inst, uint16_t(is16 ? 2 : 4), uint16_t(handler_id(exec))};
+    decode_operands(insn);
+#ifdef THREADED_DISPATCH
+    blk.insts[blk.len - 1].label = threaded_label(exec);
+#endif
+    pc += is16 ? 2 : 4;
+    if (ends_block(insn))
+      break;
+  }
+  panicifnot(blk.len);
+  blk.end = pc;
+
+  for (uint32_t line = addr >> CODE_LINE_SHIFT;
+       line <= (pc - 1) >> CODE_LINE_SHIFT; ++line)
+    codelines[line / 64] |= 1ull << (line % 64);
+
+  return blk;
+}
+
+void CpuState::invalidate_code(uint32_t address) {
+  uint32_t line = address >> CODE_LINE_SHIFT;
+  if (!(codelines[line / 64] >> (line % 64) & 1))
+    return;
+
+  for (auto &&blk : blocks) {
+    if (blk.addr < blk.end && blk.addr >> CODE_LINE_SHIFT <= line &&
+        (blk.end - 1) >> CODE_LINE_SHIFT >= line) {
+      blk.addr = blk.end = 1;
+      blk.code = nullptr;
+      blkinval = true;
+    }
+  }
+  codelines[line / 64] &= ~(1ull << (line % 64));
+}
+
+// stepping through the debugger prompt is only offered by debug builds
 #ifdef DEBUG_MODE
-  dbgr.getopt();
+static constexpr bool INTERACTIVE = true;
+#else
+static constexpr bool INTERACTIVE = false;
+#endif
+
+// the untraced instance is the plain handler call, step() picks one per block
+template <bool TRACE> void CpuState::exec_insn(const Insn &insn) {
+  isinst16 = insn.size == 2;
+  uint32_t inst = insn.inst;
+
+  if constexpr (!TRACE) {
+    (this->*insn.exec)(insn);
+    return;
+  }
+
+  if (tracefile)
+    tracefile->inst(R.inst_addr(), inst, insn.size == 4);
+  if (!trace) {
+    (this->*insn.exec)(insn);
+    return;
+  }
+
+  dbgr.setaddr(R.inst_addr());
+  if constexpr (INTERACTIVE)
+    if (dbgr.stopped())
+      dbgr.getopt();
   dbgr.pushinst(inst);
-  auto before = R;
+
+  uint32_t before[16], after[16];
+  auto snapshot = [this](uint32_t *regs) {
+    for (int i = 0; i < PC; ++i)
+      regs[i] = R.get(i);
+    regs[PC] = R.inst_addr();
+  };
+
+  snapshot(before);
+  (this->*insn.exec)(insn);
+  snapshot(after);
+
+  dbgr.pushreg(before, after);
+}
+
+template <bool TRACE> uint32_t CpuState::run_block(Block &blk, uint32_t len) {
+  uint32_t i = 0;
+  while (i < len) {
+    const Insn &insn = blk.insts[i++];
+    exec_insn<TRACE>(insn);
+
+    if (!nojmp) {
+      nojmp = true;
+      break;
+    }
+    R.pc_inc(insn.size);
+
+    // a store rewrote code cached in this very block
+    if (blkinval)
+      break;
+  }
+  return i;
+}
+
+//
+// ----- ----- JIT ----- -----
+//
+
+#define JIT_THRESHOLD 16
+#define JIT_CODE_SIZE (32 << 20)
+#define JIT_INSN_ROOM 256 // host bytes one guest instruction may expand to
+
+#if defined(__x86_64__)
+
+namespace {
+
+// generated code reaches the interpreter through plain functions
+void fault(CpuState *cpu) {
+  if (!cpu->fault)
+    cpu->fault = std::current_exception();
+  cpu->blkinval = true;
+}
+
+template <exectype exec> void call_handler(CpuState *cpu, const Insn *insn) {
+  try {
+    (cpu->*exec)(*insn);
+  } catch (const Panic &) {
+    fault(cpu);
+  }
+}
+
+const struct {
+  exectype exec;
+  void (*call)(CpuState *, const Insn *);
+} thunks[] = {
+#define X(name) {&CpuState::exec_##name, call_handler<&CpuState::exec_##name>},
+  CM0_HANDLERS(X)
+#undef X
+};
+
+uint32_t jit_load(CpuState *cpu, uint32_t address, uint32_t size) {
+  try {
+    return cpu->mem_access_aligned(address, size);
+  } catch (const Panic &) {
+    fault(cpu);
+    return 0;
+  }
+}
+
+void jit_store(CpuState *cpu, uint32_t data, uint32_t address, uint32_t size) {
+  try {
+    cpu->mem_modify_aligned(data, address, size);
+  } catch (const Panic &) {
+    fault(cpu);
+  }
+}
+
+// Translates a cached block into a host function returning how many guest
+// instructions it retired. Common data processing and load / store forms are
+// emitted inline, everything else calls the exec_* handler, so the
+// interpreter stays the reference for what each instruction does.
+class Translator {
+  using enum x64::Reg;
+  using enum x64::Cond;
+  using enum x64::Alu;
+  using enum x64::Shift;
+
+  // while a block runs rbx points at the core and all of its state is
+  // addressed relative to it, guest r0-r4 are cached in callee-saved
+  // registers so they survive calls into the interpreter
+  static constexpr x64::Reg BASE = RBX;
+  static constexpr x64::Reg hostregs[] = {R12, R13, R14, R15, RBP};
+  static constexpr uint32_t NR_HOSTREGS = std::size(hostregs);
+
+  CpuState &cpu;
+  x64::Emitter em{JIT_CODE_SIZE};
+  bool loaded[NR_HOSTREGS];
+  bool dirty[NR_HOSTREGS];
+  std::vector<uint8_t *> exits;
+  uint32_t insn_pc = 0; // of the instruction being translated
+  uint32_t insn_idx = 0; // instructions retired before it
+  bool zncleared = false; // since the block began or the last handler call
+
+  template <typename T> int32_t off(T &obj) {
+    intptr_t disp = (intptr_t)&obj - (intptr_t)&cpu;
+    panicifnot(disp == (int32_t)disp);
+    return disp;
+  }
+
+  void fetch(x64::Reg dst, uint32_t g) {
+    if (g >= NR_HOSTREGS) {
+      em.load(dst, BASE, off(cpu.R.regs[g]));
+      return;
+    }
+    if (!loaded[g]) {
+      em.load(hostregs[g], BASE, off(cpu.R.regs[g]));
+      loaded[g] = true;
+    }
+    em.mov(dst, hostregs[g]);
+  }
+
+  void put(uint32_t g, x64::Reg src) {
+    if (g >= NR_HOSTREGS) {
+      em.store(BASE, off(cpu.R.regs[g]), src);
+      return;
+    }
+    em.mov(hostregs[g], src);
+    loaded[g] = dirty[g] = true;
+  }
+
+  void fetch_sp(x64::Reg dst) {
+    em.load(dst, BASE, off(cpu.R.sp_main));
+    em.cmp8_imm(BASE, off(cpu.CTRL.SPSEL), 0);
+    em.cmovcc(CC_NE, dst, BASE, off(cpu.R.sp_process));
+  }
+
+  void put_sp(x64::Reg src) {
+    em.alu_imm(ALU_AND, src, Mask32<31, 2>);
+    em.cmp8_imm(BASE, off(cpu.CTRL.SPSEL), 0);
+    uint8_t *process = em.jcc(CC_NE);
+    em.store(BASE, off(cpu.R.sp_main), src);
+    uint8_t *done = em.jmp();
+    em.bind(process);
+    em.store(BASE, off(cpu.R.sp_process), src);
+    em.bind(done);
+  }
+
+  // write back dirty registers but keep them cached, for side exits
+  void spill() {
+    for (uint32_t g = 0; g < NR_HOSTREGS; ++g)
+      if (dirty[g])
+        em.store(BASE, off(cpu.R.regs[g]), hostregs[g]);
+  }
+
+  void flush() {
+    spill();
+    for (uint32_t g = 0; g < NR_HOSTREGS; ++g)
+      loaded[g] = dirty[g] = false;
+  }
+
+  void side_exit(uint32_t retired, uint32_t pc) {
+    spill();
+    em.store_imm(BASE, off(cpu.R._PC), pc);
+    em.mov_imm(RAX, retired);
+    exits.push_back(em.jmp());
+  }
+
+  // a store may have rewritten code cached in this very block
+  void check_inval(uint32_t retired, uint32_t pc) {
+    em.cmp8_imm(BASE, off(cpu.blkinval), 0);
+    uint8_t *valid = em.jcc(CC_E);
+    side_exit(retired, pc);
+    em.bind(valid);
+  }
+
+  // only msr and exception return set zn, both through the interpreter, so
+  // it is cleared once after entry or a handler call rather than every time
+  void clear_zn() {
+    if (!zncleared)
+      em.store8_imm(BASE, off(cpu.xPSR.zn), 0);
+    zncleared = true;
+  }
+
+  void set_nz(x64::Reg result) {
+    em.store(BASE, off(cpu.xPSR.nzres), result);
+    clear_zn();
+  }
+
+  void set_add(x64::Reg x, x64::Reg y, bool carry_in, x64::Reg result) {
+    em.store(BASE, off(cpu.xPSR.nzres), result);
+    clear_zn();
+    em.store(BASE, off(cpu.xPSR.addx), x);
+    em.store(BASE, off(cpu.xPSR.addy), y);
+    em.store8_imm(BASE, off(cpu.xPSR.addcin), carry_in);
+    em.store8_imm(BASE, off(cpu.xPSR.clazy), 1);
+    em.store8_imm(BASE, off(cpu.xPSR.vlazy), 1);
+  }
+
+  //
+  // memory accesses take the address in eax and go through the bus page
+  // table, misaligned accesses, mmio and stores to cached code take the
+  // same slow path the interpreter does
+  //
+
+  // bumps the bus counter of the page at eax, if the bus counts
+  void count(uint64_t *pages) {
+    if (!cpu.sysbus->counts())
+      return;
+    em.mov(RCX, RAX);
+    em.shift(SH_SHR, RCX, BUS_PAGE_SHIFT);
+    em.mov_imm64(R8, (uint64_t)pages);
+    em.inc_idx(R8, RCX);
+  }
+
+  void mem_load(uint32_t size, bool sext) {
+    uint8_t *misaligned = nullptr;
+    if (size > 1) {
+      em.test_imm(RAX, size - 1);
+      misaligned = em.jcc(CC_NE);
+    }
+    em.mov(RCX, RAX);
+    em.shift(SH_SHR, RCX, BUS_PAGE_SHIFT);
+    em.mov_imm64(RDX, (uint64_t)cpu.sysbus->readpages());
+    em.load_ptr(RDX, RDX, RCX);
+    em.test_ptr(RDX, RDX);
+    uint8_t *mmio = em.jcc(CC_E);
+    count(cpu.sysbus->readcounts(size));
+    em.mov(RCX, RAX);
+    em.alu_imm(ALU_AND, RCX, BUS_PAGE_MASK);
+    em.load_idx(size, sext, RAX, RDX, RCX);
+    uint8_t *done = em.jmp();
+
+    if (misaligned)
+      em.bind(misaligned);
+    em.bind(mmio);
+    // devices may read the clock, which needs pc
+    em.store_imm(BASE, off(cpu.R._PC), insn_pc);
+    em.mov_ptr(RDI, BASE);
+    em.mov(RSI, RAX);
+    em.mov_imm(RDX, size);
+    em.call((void *)jit_load);
+    // only a fault sets blkinval here
+    check_inval(insn_idx, insn_pc);
+    if (sext)
+      em.extend(size, true, RAX, RAX);
+    em.bind(done);
+  }
+
+  // data in esi
+  void mem_store(uint32_t size, uint32_t retired, uint32_t pc) {
+    uint8_t *misaligned = nullptr;
+    if (size > 1) {
+      em.test_imm(RAX, size - 1);
+      misaligned = em.jcc(CC_NE);
+    }
+    em.mov(RCX, RAX);
+    em.shift(SH_SHR, RCX, BUS_PAGE_SHIFT);
+    em.mov_imm64(RDX, (uint64_t)cpu.sysbus->writepages());
+    em.load_ptr(RDX, RDX, RCX);
+    em.test_ptr(RDX, RDX);
+    uint8_t *mmio = em.jcc(CC_E);
+    em.mov(RCX, RAX);
+    em.shift(SH_SHR, RCX, CODE_LINE_SHIFT);
+    em.mov_imm64(R8, (uint64_t)cpu.codelines);
+    em.bt(R8, RCX);
+    uint8_t *code = em.jcc(CC_C);
+    count(cpu.sysbus->writecounts(size));
+    em.mov(RCX, RAX);
+    em.alu_imm(ALU_AND, RCX, BUS_PAGE_MASK);
+    em.store_idx(size, RDX, RCX, RSI);
+    uint8_t *done = em.jmp();
+
+    if (misaligned)
+      em.bind(misaligned);
+    em.bind(mmio);
+    em.bind(code);
+    em.store_imm(BASE, off(cpu.R._PC), insn_pc);
+    em.mov_ptr(RDI, BASE);
+    em.mov(RDX, RAX);
+    em.mov_imm(RCX, size);
+    em.call((void *)jit_store);
+    check_inval(retired, pc);
+    em.bind(done);
+  }
+
+  void addr_imm(uint32_t n, uint32_t imm) {
+    fetch(RAX, n);
+    if (imm)
+      em.alu_imm(ALU_ADD, RAX, imm);
+  }
+
+  void addr_reg(uint32_t n, uint32_t m) {
+    fetch(RAX, n);
+    fetch(RCX, m);
+    em.alu(ALU_ADD, RAX, RCX);
+  }
+
+  void addr_sp(uint32_t imm) {
+    fetch_sp(RAX);
+    if (imm)
+      em.alu_imm(ALU_ADD, RAX, imm);
+  }
+
+  //
+  // instruction forms
+  //
+
+  // add_with_flags(R[n], R[m] or imm, ...), d < 0 only sets the flags
+  void add_sub(int d, uint32_t n, int m, uint32_t imm, bool sub) {
+    fetch(RAX, n);
+    if (m >= 0) {
+      fetch(RCX, m);
+      if (sub)
+        em.not_(RCX);
+    } else {
+      em.mov_imm(RCX, sub ? ~imm : imm);
+    }
+    em.mov(RDX, RAX);
+    em.alu(ALU_ADD, RDX, RCX);
+    if (sub)
+      em.alu_imm(ALU_ADD, RDX, 1);
+    set_add(RAX, RCX, sub, RDX);
+    if (d >= 0)
+      put(d, RDX);
+  }
+
+  void logical(x64::Alu op, bool invert, bool wback, const Insn &insn) {
+    fetch(RAX, insn.n);
+    fetch(RCX, insn.m);
+    if (invert)
+      em.not_(RCX);
+    em.alu(op, RAX, RCX);
+    set_nz(RAX);
+    if (wback)
+      put(insn.d, RAX);
+  }
+
+  bool shift_imm(x64::Shift op, const Insn &insn) {
+    // lsl #0 is a plain move, lsr / asr #0 shift by 32
+    if (insn.imm == 0 || insn.imm == 32)
+      return false;
+
+    fetch(RAX, insn.m);
+    em.shift(op, RAX, insn.imm);
+    em.setcc(CC_C, BASE, off(cpu.xPSR.c));
+    em.store8_imm(BASE, off(cpu.xPSR.clazy), 0);
+    set_nz(RAX);
+    put(insn.d, RAX);
+    return true;
+  }
+
+  void extend(uint32_t size, bool sext, const Insn &insn) {
+    fetch(RAX, insn.m);
+    em.extend(size, sext, RAX, RAX);
+    put(insn.d, RAX);
+  }
+
+  void load_to(uint32_t t, uint32_t size, bool sext = false) {
+    mem_load(size, sext);
+    put(t, RAX);
+  }
+
+  bool native(const Insn &insn, uint32_t pc, uint32_t retired) {
+    exectype exec = insn.exec;
+    uint32_t next = pc + insn.size;
+
+    if (exec == &CpuState::exec_nop_t1 || exec == &CpuState::exec_dmb_t1 || exec == &CpuState::exec_dsb_t1 ||
+        exec == &CpuState::exec_isb_t1)
+      return true;
+
+    if (exec == &CpuState::exec_mov_imm_t1) {
+      em.mov_imm(RAX, insn.imm);
+      put(insn.d, RAX);
+      set_nz(RAX);
+      return true;
+    }
+
+    if (exec == &CpuState::exec_add_imm_t1 || exec == &CpuState::exec_sub_imm_t1 ||
+        exec == &CpuState::exec_add_imm_t2 || exec == &CpuState::exec_sub_imm_t2) {
+      add_sub(insn.d, insn.n, -1, insn.imm,
+              exec == &CpuState::exec_sub_imm_t1 || exec == &CpuState::exec_sub_imm_t2);
+      return true;
+    }
+    if (exec == &CpuState::exec_add_reg_t1 || exec == &CpuState::exec_sub_reg_t1) {
+      add_sub(insn.d, insn.n, insn.m, 0, exec == &CpuState::exec_sub_reg_t1);
+      return true;
+    }
+    if (exec == &CpuState::exec_cmp_imm_t1) {
+      add_sub(-1, insn.n, -1, insn.imm, true);
+      return true;
+    }
+    if (exec == &CpuState::exec_cmp_reg_t1 || exec == &CpuState::exec_cmn_reg_t1) {
+      add_sub(-1, insn.n, insn.m, 0, exec == &CpuState::exec_cmp_reg_t1);
+      return true;
+    }
+    if (exec == &CpuState::exec_rsb_imm_t1) {
+      fetch(RAX, insn.n);
+      em.not_(RAX);
+      em.mov_imm(RCX, 0);
+      em.mov(RDX, RAX);
+      em.alu_imm(ALU_ADD, RDX, 1);
+      set_add(RAX, RCX, true, RDX);
+      put(insn.d, RDX);
+      return true;
+    }
+
+    if (exec == &CpuState::exec_and_reg_t1) {
+      logical(ALU_AND, false, true, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_eor_reg_t1) {
+      logical(ALU_XOR, false, true, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_orr_reg_t1) {
+      logical(ALU_OR, false, true, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_bic_reg_t1) {
+      logical(ALU_AND, true, true, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_tst_reg_t1) {
+      logical(ALU_AND, false, false, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_mvn_reg_t1 || exec == &CpuState::exec_mov_reg_t2) {
+      fetch(RAX, insn.m);
+      if (exec == &CpuState::exec_mvn_reg_t1)
+        em.not_(RAX);
+      set_nz(RAX);
+      put(insn.d, RAX);
+      return true;
+    }
+    if (exec == &CpuState::exec_mul_t1) {
+      fetch(RAX, insn.n);
+      fetch(RCX, insn.m);
+      em.imul(RAX, RCX);
+      set_nz(RAX);
+      put(insn.d, RAX);
+      return true;
+    }
+
+    if (exec == &CpuState::exec_lsl_imm_t1)
+      return shift_imm(SH_SHL, insn);
+    if (exec == &CpuState::exec_lsr_imm_t1)
+      return shift_imm(SH_SHR, insn);
+    if (exec == &CpuState::exec_asr_imm_t1)
+      return shift_imm(SH_SAR, insn);
+
+    if (exec == &CpuState::exec_mov_reg_t1 || exec == &CpuState::exec_add_reg_t2) {
+      if (insn.d >= SP || insn.m >= SP)
+        return false;
+      fetch(RAX, insn.m);
+      if (exec == &CpuState::exec_add_reg_t2) {
+        fetch(RCX, insn.n);
+        em.alu(ALU_ADD, RAX, RCX);
+      }
+      put(insn.d, RAX);
+      return true;
+    }
+
+    if (exec == &CpuState::exec_adr_t1) {
+      em.mov_imm(RAX, ALIGN(pc + 4, 4) + insn.imm);
+      put(insn.d, RAX);
+      return true;
+    }
+    if (exec == &CpuState::exec_add_sp_imm_t1) {
+      addr_sp(insn.imm);
+      put(insn.d, RAX);
+      return true;
+    }
+    if (exec == &CpuState::exec_add_sp_imm_t2 || exec == &CpuState::exec_sub_sp_imm_t1) {
+      fetch_sp(RAX);
+      em.alu_imm(exec == &CpuState::exec_add_sp_imm_t2 ? ALU_ADD : ALU_SUB, RAX,
+                 insn.imm);
+      put_sp(RAX);
+      return true;
+    }
+
+    if (exec == &CpuState::exec_sxtb_t1 || exec == &CpuState::exec_uxtb_t1) {
+      extend(1, exec == &CpuState::exec_sxtb_t1, insn);
+      return true;
+    }
+    if (exec == &CpuState::exec_sxth_t1 || exec == &CpuState::exec_uxth_t1) {
+      extend(2, exec == &CpuState::exec_sxth_t1, insn);
+      return true;
+    }
+
+    uint32_t t = insn.d, n = insn.n, m = insn.m, imm = insn.imm;
+
+    if (exec == &CpuState::exec_ldr_imm_t1) {
+      addr_imm(n, imm);
+      load_to(t, 4);
+    } else if (exec == &CpuState::exec_ldrh_imm_t1) {
+      addr_imm(n, imm);
+      load_to(t, 2);
+    } else if (exec == &CpuState::exec_ldrb_imm_t1) {
+      addr_imm(n, imm);
+      load_to(t, 1);
+    } else if (exec == &CpuState::exec_ldr_reg_t1) {
+      addr_reg(n, m);
+      load_to(t, 4);
+    } else if (exec == &CpuState::exec_ldrh_reg_t1) {
+      addr_reg(n, m);
+      load_to(t, 2);
+    } else if (exec == &CpuState::exec_ldrb_reg_t1) {
+      addr_reg(n, m);
+      load_to(t, 1);
+    } else if (exec == &CpuState::exec_ldrsh_reg_t1) {
+      addr_reg(n, m);
+      load_to(t, 2, true);
+    } else if (exec == &CpuState::exec_ldrsb_reg_t1) {
+      addr_reg(n, m);
+      load_to(t, 1, true);
+    } else if (exec == &CpuState::exec_ldr_imm_t2) {
+      addr_sp(imm);
+      load_to(t, 4);
+    } else if (exec == &CpuState::exec_ldr_lit_t1) {
+      em.mov_imm(RAX, ALIGN(pc + 4, 4) + imm);
+      load_to(t, 4);
+    } else if (exec == &CpuState::exec_str_imm_t1) {
+      fetch(RSI, t);
+      addr_imm(n, imm);
+      mem_store(4, retired, next);
+    } else if (exec == &CpuState::exec_strh_imm_t1) {
+      fetch(RSI, t);
+      addr_imm(n, imm);
+      mem_store(2, retired, next);
+    } else if (exec == &CpuState::exec_strb_imm_t1) {
+      fetch(RSI, t);
+      addr_imm(n, imm);
+      mem_store(1, retired, next);
+    } else if (exec == &CpuState::exec_str_reg_t1) {
+      fetch(RSI, t);
+      addr_reg(n, m);
+      mem_store(4, retired, next);
+    } else if (exec == &CpuState::exec_strh_reg_t1) {
+      fetch(RSI, t);
+      addr_reg(n, m);
+      mem_store(2, retired, next);
+    } else if (exec == &CpuState::exec_strb_reg_t1) {
+      fetch(RSI, t);
+      addr_reg(n, m);
+      mem_store(1, retired, next);
+    } else if (exec == &CpuState::exec_str_imm_t2) {
+      fetch(RSI, t);
+      addr_sp(imm);
+      mem_store(4, retired, next);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void interp(const Insn &insn, uint32_t pc) {
+    flush();
+    em.store_imm(BASE, off(cpu.R._PC), pc);
+    em.store8_imm(BASE, off(cpu.isinst16), insn.size == 2);
+    em.mov_ptr(RDI, BASE);
+    // the block owns both its code and its insts, they go away together
+    em.mov_imm64(RSI, (uint64_t)&insn);
+    em.call((void *)thunk(insn.exec));
+    zncleared = false;
+  }
+
+  static void (*thunk(exectype exec))(CpuState *, const Insn *) {
+    for (auto &&t : thunks)
+      if (t.exec == exec)
+        return t.call;
+    panic("unreachable");
+    return nullptr;
+  }
+
+public:
+  Translator(CpuState &cpu) : cpu(cpu) {}
+
+  jitfn translate(Block &blk) {
+    if (em.room() < blk.len * JIT_INSN_ROOM + 256) {
+      em.reset();
+      for (auto &&b : cpu.blocks) {
+        b.code = nullptr;
+        b.hits = 0;
+      }
+    }
+
+    jitfn fn = (jitfn)em.cur();
+    for (uint32_t g = 0; g < NR_HOSTREGS; ++g)
+      loaded[g] = dirty[g] = false;
+    exits.clear();
+    zncleared = false;
+
+    em.push(RBX);
+    em.push(RBP);
+    em.push(R12);
+    em.push(R13);
+    em.push(R14);
+    em.push(R15);
+    em.adjust_rsp(-8);
+    em.mov_ptr(BASE, RDI);
+
+    uint32_t pc = blk.addr;
+    bool branch = false;
+    for (uint32_t i = 0; i < blk.len; ++i) {
+      const Insn &insn = blk.insts[i];
+      insn_pc = pc;
+      insn_idx = i;
+      if (!native(insn, pc, i + 1)) {
+        interp(insn, pc);
+        branch = ends_block(insn);
+        if (!branch)
+          check_inval(i + 1, pc + insn.size);
+      }
+      pc += insn.size;
+    }
+
+    if (branch) {
+      // the handler only touched pc if it branched
+      em.cmp8_imm(BASE, off(cpu.nojmp), 0);
+      uint8_t *taken = em.jcc(CC_E);
+      em.store_imm(BASE, off(cpu.R._PC), blk.end);
+      uint8_t *done = em.jmp();
+      em.bind(taken);
+      em.store8_imm(BASE, off(cpu.nojmp), 1);
+      em.bind(done);
+    } else {
+      em.store_imm(BASE, off(cpu.R._PC), blk.end);
+    }
+    flush();
+    em.mov_imm(RAX, blk.len);
+
+    for (auto &&slot : exits)
+      em.bind(slot);
+    em.adjust_rsp(8);
+    em.pop(R15);
+    em.pop(R14);
+    em.pop(R13);
+    em.pop(R12);
+    em.pop(RBP);
+    em.pop(RBX);
+    em.ret();
+
+    return fn;
+  }
+};
+
+} // namespace
+
+static Translator *jit_init(CpuState &cpu) { return new Translator(cpu); }
+
+#else
+
+namespace {
+
+class Translator {
+public:
+  jitfn translate(Block &blk) { return nullptr; }
+};
+
+} // namespace
+
+static Translator *jit_init(CpuState &cpu) {
+  fprintf(stderr, "jit is not available in this build, using the interpreter\n");
+  return nullptr;
+}
+
 #endif
 
-  exec(inst);
+CpuState::~CpuState() {
+  delete translator;
+  delete tracefile;
+  if (profiler)
+    profiler->report(profout);
+  delete profiler;
+}
+
+#ifdef THREADED_DISPATCH
+
+// every handler body ends in its own indirect jump to the next instruction,
+// passing nullptr only hands out the label table
+uint32_t CpuState::run_threaded(Block *blk, uint32_t len) {
+  static void *const table[] = {
+#define X(name) &&L_##name,
+    CM0_HANDLERS(X)
+#undef X
+  };
+
+  if (!blk) {
+    labels = table;
+    return 0;
+  }
+
+  const Insn *insn = blk->insts;
+  const Insn *end = insn + len;
+
+#define NEXT                                                                   \
+  do {                                                                         \
+    if (!nojmp) {                                                              \
+      nojmp = true;                                                            \
+      return insn - blk->insts + 1;                                            \
+    }                                                                          \
+    R.pc_inc(insn->size);                                                      \
+    if (blkinval || insn + 1 == end)                                           \
+      return insn - blk->insts + 1;                                            \
+    ++insn;                                                                    \
+    goto *insn->label;                                                         \
+  } while (0)
+
+  goto *insn->label;
+
+#define X(name)                                                                \
+  L_##name:                                                                    \
+  isinst16 = insn->size == 2;                                                  \
+  exec_##name(*insn);                                                          \
+  NEXT;
+  CM0_HANDLERS(X)
+#undef X
+#undef NEXT
+}
 
-#ifdef DEBUG_MODE
-  char buf[16][256];
-  for (int i = 0; i < 13; ++i)
-    sprintf(buf[i], "R%02d: %08x => %08x\n", i, before.get(i), R.get(i));
-  sprintf(buf[SP], "SP : %08x => %08x\n", before.get(SP), R.get(SP));
-  sprintf(buf[LR], "LR : %08x => %08x\n", before.get(LR), R.get(LR));
-  sprintf(buf[PC], "PC : %08x => %08x", before.inst_addr(), R.inst_addr());
-  std::stringstream ss;
-  for (int i = 0; i < 16; ++i)
-    ss << buf[i];
-  dbgr.pushreg(ss.str());
 #endif
 
-  if (nojmp)
-    R.pc_inc(isinst16 ? 2 : 4);
-  nojmp = true;
+// runs the block at pc, up to @budget instructions of it
+uint32_t CpuState::run_next(uint32_t budget) {
+  Block &blk = fetch_block(R.inst_addr());
+  uint32_t len = std::min<uint32_t>(blk.len, budget);
+  blkinval = false;
+
+  uint32_t n;
+  if (translator && len == blk.len && !blk.code &&
+      ++blk.hits == JIT_THRESHOLD)
+    blk.code = translator->translate(blk);
+
+  curblk = &blk;
+  if (blk.code && len == blk.len) {
+    n = blk.code(this);
+    if (fault)
+      std::rethrow_exception(std::exchange(fault, nullptr));
+  } else if (tracing)
+    n = run_block<true>(blk, len);
+  else
+#ifdef THREADED_DISPATCH
+    n = run_threaded(&blk, len);
+#else
+    n = run_block<false>(blk, len);
+#endif
+
+  curblk = nullptr;
+  cycles += (uint64_t)n * cpi;
+  retire(blk, n);
+  if (idleskip && sysbus->io_reads() != ioseen)
+    check_poll();
+  return n;
+}
+
+// compared after each block that read a device, polling for something that
+// has not happened leaves every register as it was the time before
+void CpuState::check_poll() {
+  ioseen = sysbus->io_reads();
+  uint32_t regs[16];
+  for (uint32_t i = 0; i < 16; ++i)
+    regs[i] = R.get(i);
+  if (memcmp(regs, pollregs, sizeof(regs))) {
+    memcpy(pollregs, regs, sizeof(regs));
+    polls = 0;
+    return;
+  }
+  if (++polls == IDLE_POLLS) {
+    polls = 0;
+    idle();
+  }
+}
+
+// jump to the next event in guest time of any device, the one polled or
+// one that may raise an interrupt, which is then taken at its own cycle.
+// Without one the guest waits on the host clock or on nothing, so give the
+// host core away for a while.
+void CpuState::idle() {
+  uint64_t t = now();
+  uint64_t next = sysbus->next_event(t);
+  // one at or before t only asks for a recheck between blocks
+  if (nvic && nvic->check_at > t)
+    next = std::min(next, nvic->check_at);
+  if (next != ~0ull) {
+    cycles += next - t;
+    skipped += next - t;
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP_US));
+  sysbus->resync();
+  sleeps += 1;
 }
 
-void Cortex_M0::Step(unsigned in) {
-  uint32_t inst = 0;
-  uint16_t loinst = 0;
-  uint16_t hiinst = 0;
-  uint32_t curaddr = R.inst_addr();
-  dbgr.setaddr(curaddr);
-  sysbus->read16(loinst, curaddr);
-  sysbus->read16(hiinst, curaddr + 2);
-  decode_and_exec((loinst << 16) | hiinst);
+// complete runs only bump the block, the rare partial ones count right away
+void CpuState::retire(Block &blk, uint32_t n) {
+  if (n == blk.len) {
+    blk.runs += 1;
+    return;
+  }
+  for (uint32_t i = 0; i < n; ++i)
+    handler_counts[blk.insts[i].id] += 1;
+}
+
+// devices read the clock from inside a block, the instructions of it retired
+// so far are found by walking up to pc
+uint64_t CpuState::now() {
+  if (!curblk)
+    return cycles;
+  uint32_t pc = curblk->addr;
+  uint32_t i = 0;
+  while (i < curblk->len && pc != R.inst_addr())
+    pc += curblk->insts[i++].size;
+  return cycles + (i < curblk->len ? (uint64_t)i * cpi : 0);
+}
+
+void CpuState::dump_counters(FILE *fp) {
+  uint64_t counts[NR_HANDLERS];
+  std::copy(std::begin(handler_counts), std::end(handler_counts), counts);
+  for (auto &&blk : blocks)
+    for (uint32_t i = 0; i < blk.len; ++i)
+      counts[blk.insts[i].id] += blk.runs;
+
+  uint64_t retired = std::accumulate(counts, counts + NR_HANDLERS, 0ull);
+  fprintf(fp, "{\n    \"retired\": %" PRIu64 ",\n", retired);
+  fprintf(fp, "    \"cycles\": %" PRIu64 ",\n", now());
+  fprintf(fp, "    \"handlers\": {");
+  for (size_t i = 0; i < NR_HANDLERS; ++i)
+    fprintf(fp, "%s\n      \"%s\": %" PRIu64, i ? "," : "", handler_names[i],
+            counts[i]);
+  fprintf(fp, "\n    },\n");
+  fprintf(fp, "    \"branches\": {\"taken\": %" PRIu64
+              ", \"not_taken\": %" PRIu64 "},\n",
+          branches_taken, branches_not_taken);
+  fprintf(fp, "    \"idle\": {\"skipped_cycles\": %" PRIu64
+              ", \"sleeps\": %" PRIu64 "}\n  }",
+          skipped, sleeps);
+}
+
+unsigned CpuState::step(unsigned in) {
+  unsigned retired = 0;
+
+  while (retired < in && !halted) {
+    uint32_t n = run_next(in - retired);
+    retired += n;
+    if (profiler)
+      profiler->tick(R.inst_addr(), n);
+    if (nvic && cycles >= nvic->check_at)
+      take_exception();
+  }
+
+  return retired;
 }
+
+//
+// ----- ----- Cortex_M0 ----- -----
+//
+
+Cortex_M0::Cortex_M0(SystemBus *bus, Nvic *nvic, const CpuOptions &opts)
+    : state(new CpuState(bus, nvic, opts)) {}
+
+Cortex_M0::~Cortex_M0() { delete state; }
+
+unsigned Cortex_M0::Step(unsigned in) { return state->step(in); }
+
+bool Cortex_M0::Halted() { return state->halted; }
+
+uint32_t Cortex_M0::ExitCode() { return state->exitcode; }
+
+uint64_t Cortex_M0::Cycles() { return state->now(); }
+
+void Cortex_M0::DumpCounters(FILE *fp) { state->dump_counters(fp); }
@@ -0,0 +1,287 @@
+#include <sys/mman.h>
+
+#include "common.hh"
+#include "cpu/x64emit.hh"
+
+namespace x64 {
+
+Emitter::Emitter(size_t siz) : cap(siz) {
+  void *p = mmap(nullptr, siz, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    panic("can not map code buffer");
+  buf = (uint8_t *)p;
+}
+
+Emitter::~Emitter() { munmap(buf, cap); }
+
+void Emitter::byte(uint8_t b) {
+  panicifnot(pos < cap);
+  buf[pos++] = b;
+}
+
+void Emitter::dword(uint32_t d) {
+  for (int i = 0; i < 4; ++i)
+    byte(d >> (i * 8));
+}
+
+void Emitter::qword(uint64_t q) {
+  dword(q);
+  dword(q >> 32);
+}
+
+//
+// ----- ----- Encoding ----- -----
+//
+
+void Emitter::rex(bool w, int reg, int index, int base, bool force) {
+  uint8_t r = 0x40 | w << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | (base >> 3);
+  if (r != 0x40 || force)
+    byte(r);
+}
+
+void Emitter::modrm_reg(int reg, int rm) {
+  byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void Emitter::modrm_mem(int reg, Reg base, int32_t disp) {
+  byte(0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == RSP)
+    byte(0x24);
+  dword(disp);
+}
+
+void Emitter::modrm_sib(int reg, Reg base, Reg index, int scale) {
+  panicifnot((index & 7) != RSP || index == R12);
+  uint8_t sib = scale << 6 | (index & 7) << 3 | (base & 7);
+  if ((base & 7) == RBP) {
+    // no disp-less form with rbp / r13 as base
+    byte(0x44 | (reg & 7) << 3);
+    byte(sib);
+    byte(0);
+  } else {
+    byte(0x04 | (reg & 7) << 3);
+    byte(sib);
+  }
+}
+
+//
+// ----- ----- Instructions ----- -----
+//
+
+void Emitter::push(Reg r) {
+  rex(false, 0, 0, r);
+  byte(0x50 + (r & 7));
+}
+
+void Emitter::pop(Reg r) {
+  rex(false, 0, 0, r);
+  byte(0x58 + (r & 7));
+}
+
+void Emitter::ret() { byte(0xc3); }
+
+void Emitter::adjust_rsp(int8_t imm) {
+  // add rsp, imm8
+  rex(true, 0, 0, RSP);
+  byte(0x83);
+  modrm_reg(0, RSP);
+  byte(imm);
+}
+
+void Emitter::call(const void *fn) {
+  mov_imm64(RAX, (uint64_t)fn);
+  byte(0xff);
+  modrm_reg(2, RAX);
+}
+
+void Emitter::mov(Reg dst, Reg src) {
+  rex(false, src, 0, dst);
+  byte(0x89);
+  modrm_reg(src, dst);
+}
+
+void Emitter::mov_ptr(Reg dst, Reg src) {
+  rex(true, src, 0, dst);
+  byte(0x89);
+  modrm_reg(src, dst);
+}
+
+void Emitter::mov_imm(Reg dst, uint32_t imm) {
+  rex(false, 0, 0, dst);
+  byte(0xb8 + (dst & 7));
+  dword(imm);
+}
+
+void Emitter::mov_imm64(Reg dst, uint64_t imm) {
+  rex(true, 0, 0, dst);
+  byte(0xb8 + (dst & 7));
+  qword(imm);
+}
+
+void Emitter::load(Reg dst, Reg base, int32_t disp) {
+  rex(false, dst, 0, base);
+  byte(0x8b);
+  modrm_mem(dst, base, disp);
+}
+
+void Emitter::store(Reg base, int32_t disp, Reg src) {
+  rex(false, src, 0, base);
+  byte(0x89);
+  modrm_mem(src, base, disp);
+}
+
+void Emitter::store_imm(Reg base, int32_t disp, uint32_t imm) {
+  rex(false, 0, 0, base);
+  byte(0xc7);
+  modrm_mem(0, base, disp);
+  dword(imm);
+}
+
+void Emitter::store8_imm(Reg base, int32_t disp, uint8_t imm) {
+  rex(false, 0, 0, base);
+  byte(0xc6);
+  modrm_mem(0, base, disp);
+  byte(imm);
+}
+
+void Emitter::cmp8_imm(Reg base, int32_t disp, uint8_t imm) {
+  rex(false, 0, 0, base);
+  byte(0x80);
+  modrm_mem(7, base, disp);
+  byte(imm);
+}
+
+void Emitter::setcc(Cond cc, Reg base, int32_t disp) {
+  rex(false, 0, 0, base);
+  byte(0x0f);
+  byte(0x90 + cc);
+  modrm_mem(0, base, disp);
+}
+
+void Emitter::cmovcc(Cond cc, Reg dst, Reg base, int32_t disp) {
+  rex(false, dst, 0, base);
+  byte(0x0f);
+  byte(0x40 + cc);
+  modrm_mem(dst, base, disp);
+}
+
+void Emitter::load_ptr(Reg dst, Reg base, Reg index) {
+  rex(true, dst, index, base);
+  byte(0x8b);
+  modrm_sib(dst, base, index, 3);
+}
+
+void Emitter::load_idx(int size, bool sext, Reg dst, Reg base,
+                          Reg index) {
+  rex(false, dst, index, base);
+  if (size == 4) {
+    byte(0x8b);
+  } else {
+    byte(0x0f);
+    byte((sext ? 0xbe : 0xb6) + (size == 2));
+  }
+  modrm_sib(dst, base, index, 0);
+}
+
+void Emitter::store_idx(int size, Reg base, Reg index, Reg src) {
+  if (size == 2)
+    byte(0x66);
+  // without rex, byte registers 4-7 would be ah, ch, dh, bh
+  rex(false, src, index, base, size == 1 && src >= RSP);
+  byte(size == 1 ? 0x88 : 0x89);
+  modrm_sib(src, base, index, 0);
+}
+
+void Emitter::inc_idx(Reg base, Reg index) {
+  rex(true, 0, index, base);
+  byte(0xff);
+  modrm_sib(0, base, index, 3);
+}
+
+void Emitter::bt(Reg base, Reg bit) {
+  panicifnot((base & 7) != RSP && (base & 7) != RBP);
+  rex(true, bit, 0, base);
+  byte(0x0f);
+  byte(0xa3);
+  byte((bit & 7) << 3 | (base & 7));
+}
+
+void Emitter::alu(Alu op, Reg dst, Reg src) {
+  rex(false, src, 0, dst);
+  byte(op << 3 | 0x01);
+  modrm_reg(src, dst);
+}
+
+void Emitter::alu_imm(Alu op, Reg dst, uint32_t imm) {
+  rex(false, 0, 0, dst);
+  byte(0x81);
+  modrm_reg(op, dst);
+  dword(imm);
+}
+
+void Emitter::shift(Shift op, Reg dst, uint8_t imm) {
+  rex(false, 0, 0, dst);
+  byte(0xc1);
+  modrm_reg(op, dst);
+  byte(imm);
+}
+
+void Emitter::not_(Reg r) {
+  rex(false, 0, 0, r);
+  byte(0xf7);
+  modrm_reg(2, r);
+}
+
+void Emitter::imul(Reg dst, Reg src) {
+  rex(false, dst, 0, src);
+  byte(0x0f);
+  byte(0xaf);
+  modrm_reg(dst, src);
+}
+
+void Emitter::test(Reg a, Reg b) {
+  rex(false, b, 0, a);
+  byte(0x85);
+  modrm_reg(b, a);
+}
+
+void Emitter::test_ptr(Reg a, Reg b) {
+  rex(true, b, 0, a);
+  byte(0x85);
+  modrm_reg(b, a);
+}
+
+void Emitter::test_imm(Reg r, uint32_t imm) {
+  rex(false, 0, 0, r);
+  byte(0xf7);
+  modrm_reg(0, r);
+  dword(imm);
+}
+
+void Emitter::extend(int size, bool sext, Reg dst, Reg src) {
+  rex(false, dst, 0, src, size == 1 && src >= RSP);
+  byte(0x0f);
+  byte((sext ? 0xbe : 0xb6) + (size == 2));
+  modrm_reg(dst, src);
+}
+
+uint8_t *Emitter::jcc(Cond cc) {
+  byte(0x0f);
+  byte(0x80 + cc);
+  dword(0);
+  return cur() - 4;
+}
+
+uint8_t *Emitter::jmp() {
+  byte(0xe9);
+  dword(0);
+  return cur() - 4;
+}
+
+void Emitter::bind(uint8_t *slot) {
+  int32_t rel = cur() - (slot + 4);
+  memcpy(slot, &rel, sizeof(rel));
+}
+
+} // namespace x64
@@ -0,0 +1,180 @@
+#include <getopt.h>
+#include <zlib.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "bus/device.hh"
+#include "debug/tracefile.hh"
+
+// Decodes a file written by sim --trace-file
+
+struct Filter {
+  uint32_t lo = 0;
+  uint32_t hi = UINT32_MAX;
+  uint64_t limit = UINT64_MAX; // instructions to print
+  bool summary = false;
+};
+
+struct Stats {
+  uint64_t insts = 0;
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  uint64_t lost = 0;
+  uint64_t printed = 0;
+  bool done = false; // printed all -n asked for, the rest is not read
+};
+
+static bool decode(const uint8_t *p, const uint8_t *end, const Filter &filter,
+                   Stats &stats) {
+  uint32_t nextpc = 0;
+  uint32_t lastaddr = 0;
+  bool shown = false; // whether the instruction owning a mem record printed
+
+  while (p < end) {
+    uint64_t v;
+    if (!(p = etrace::get_varint(p, end, v)))
+      return false;
+
+    if (!(v & 1)) {
+      bool is32 = v >> 1 & 1;
+      uint32_t pc = nextpc + etrace::unzigzag(v >> 2);
+      uint32_t size = is32 ? 4 : 2;
+      if (end - p < size)
+        return false;
+      if (!filter.summary && stats.printed >= filter.limit) {
+        stats.done = true;
+        return true;
+      }
+      uint32_t opcode = 0;
+      for (uint32_t i = 0; i < size; ++i)
+        opcode |= (uint32_t)*p++ << (i * 8);
+      nextpc = pc + size;
+
+      stats.insts += 1;
+      shown = !filter.summary && pc >= filter.lo && pc < filter.hi;
+      if (shown) {
+        stats.printed += 1;
+        printf(is32 ? "%08x: %08x\n" : "%08x: %04x\n", pc, opcode);
+      }
+    } else {
+      uint64_t data;
+      if (!(p = etrace::get_varint(p, end, data)))
+        return false;
+      bool write = v >> 1 & 1;
+      uint32_t size = 1 << (v >> 2 & 3);
+      uint32_t addr = lastaddr + etrace::unzigzag(v >> 4);
+      lastaddr = addr;
+
+      (write ? stats.writes : stats.reads) += 1;
+      if (shown)
+        printf("          %c%u @%08x %08x\n", write ? 'w' : 'r', size, addr,
+               (uint32_t)data);
+    }
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: simtrace [-s] [-r lo:hi] [-n N] <trace>\n"
+                  "  -s        only print totals\n"
+                  "  -r lo:hi  only print instructions with lo <= pc < hi\n"
+                  "  -n N      stop after printing N instructions\n");
+}
+
+int main(int argc, char *argv[]) {
+  Filter filter;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "sr:n:h")) != -1) {
+    switch (opt) {
+    case 's':
+      filter.summary = true;
+      break;
+    case 'r': {
+      char *sep;
+      filter.lo = strtoul(optarg, &sep, 0);
+      if (*sep != ':') {
+        usage();
+        return EXIT_FAILURE;
+      }
+      filter.hi = strtoul(sep + 1, nullptr, 0);
+      break;
+    }
+    case 'n':
+      filter.limit = strtoull(optarg, nullptr, 0);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  FILE *fp = fopen(argv[optind], "rb");
+  if (!fp) {
+    fprintf(stderr, "can not open %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  char version[4];
+  if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) ||
+      fread(version, sizeof(version), 1, fp) != 1 ||
+      load_le<uint32_t>(version) != TRACE_VERSION) {
+    fprintf(stderr, "%s is not a version %d trace\n", argv[optind],
+            TRACE_VERSION);
+    return EXIT_FAILURE;
+  }
+
+  Stats stats;
+  std::vector<uint8_t> comp, raw;
+  while (!stats.done) {
+    // rawsize, compsize and lost
+    char head[16];
+    size_t got = fread(head, 1, sizeof(head), fp);
+    if (!got)
+      break;
+    uint32_t rawsize = load_le<uint32_t>(head);
+    uint32_t compsize = load_le<uint32_t>(head + 4);
+    uint64_t lost = load_le<uint64_t>(head + 8);
+    if (got != sizeof(head) || rawsize > TRACE_BLOCK_SIZE) {
+      fprintf(stderr, "truncated block header\n");
+      return EXIT_FAILURE;
+    }
+
+    comp.resize(compsize);
+    raw.resize(rawsize);
+    uLongf rawlen = rawsize;
+    if (fread(comp.data(), 1, compsize, fp) != compsize ||
+        uncompress(raw.data(), &rawlen, comp.data(), compsize) != Z_OK ||
+        rawlen != rawsize) {
+      fprintf(stderr, "corrupt block\n");
+      return EXIT_FAILURE;
+    }
+
+    if (lost) {
+      stats.lost += lost;
+      if (!filter.summary)
+        printf("-- %" PRIu64 " records lost\n", lost);
+    }
+    if (!decode(raw.data(), raw.data() + rawsize, filter, stats)) {
+      fprintf(stderr, "corrupt record\n");
+      return EXIT_FAILURE;
+    }
+  }
+  fclose(fp);
+
+  if (filter.summary)
+    printf("insts: %" PRIu64 "\nreads: %" PRIu64 "\nwrites: %" PRIu64
+           "\nlost: %" PRIu64 "\n",
+           stats.insts, stats.reads, stats.writes, stats.lost);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#!/bin/sh
+# Encodings that match more than one pattern of the decoder table. The old
+# trie tried the 0/1 child before the x child at every bit from the top, so
+# the pattern fixing a bit the other leaves as x, at the first such bit,
+# wins. Every overlapping pair in src/cpu/cortex-m0.cc needs a row here, and
+# its sample has to retire on the winner's handler.
+# usage: decode-overlaps.sh <sim>
+
+sim=${1:-build/sim}
+src=$(dirname "$0")/../src/cpu/cortex-m0.cc
+img=$(mktemp)
+counters=$(mktemp)
+trap 'rm -f "$img" "$counters"' EXIT
+
+# winner loser sample, a 32-bit sample is both halfwords, first one high
+table='
+exec_mov_reg_t2 exec_lsl_imm_t1 0x0000
+exec_mov_reg_t2 exec_lsl_imm_t1 0x002a
+exec_mov_reg_t2 exec_lsl_imm_t1 0x003f
+'
+
+patterns=$(sed -n 's/^ *insert("\([^"]*\)", *&CpuState::\(exec_[a-z0-9_]*\));.*/\1 \2/p' "$src" |
+           awk '{ name = $NF; $NF = ""; gsub(/[ \047]/, ""); print $0, name }')
+
+# every overlapping pair as "winner loser"
+pairs=$(echo "$patterns" | awk '
+  { pat[NR] = $1; name[NR] = $2 }
+  END {
+    for (i = 1; i <= NR; i++)
+      for (j = i + 1; j <= NR; j++) {
+        a = pat[i]; b = pat[j]
+        if (length(a) != length(b))
+          continue
+        first = 0
+        for (k = 1; k <= length(a); k++) {
+          x = substr(a, k, 1); y = substr(b, k, 1)
+          if (x != "x" && y != "x" && x != y)
+            break
+          if (!first && (x == "x") != (y == "x"))
+            first = k
+        }
+        if (k <= length(a))
+          continue
+        if (substr(a, first, 1) == "x")
+          print name[j], name[i]
+        else
+          print name[i], name[j]
+      }
+  }' | sort -u)
+
+expected=$(echo "$table" | awk 'NF { print $1, $2 }' | sort -u)
+if [ "$pairs" != "$expected" ]; then
+  echo "decode-overlaps: overlapping patterns changed, now:"
+  echo "$pairs"
+  exit 1
+fi
+
+# little-endian halfwords
+h() {
+  for x; do
+    printf "\\$(printf %03o $((x & 0xff)))\\$(printf %03o $(((x >> 8) & 0xff)))"
+  done
+}
+
+count() {
+  sed -n "s/^ *\"$1\": \([0-9]*\).*/\1/p" "$counters"
+}
+
+# whether the pattern of handler $1 matches encoding $2
+matches() {
+  echo "$patterns" | awk -v name="$1" -v sample=$(($2)) '
+    $2 == name {
+      v = sample; ok = 1
+      for (k = length($1); k >= 1; k--) {
+        c = substr($1, k, 1)
+        if (c != "x" && c != v % 2)
+          ok = 0
+        v = int(v / 2)
+      }
+    }
+    END { exit !ok }'
+}
+
+echo "$table" | while read -r winner loser sample; do
+  [ -n "$winner" ] || continue
+  if ! matches "$winner" "$sample" || ! matches "$loser" "$sample"; then
+    echo "decode-overlaps: $sample is not in both $winner and $loser"
+    exit 1
+  fi
+  {
+    h 0x1000 0x2000     # msp 0x20001000
+    h 0x8009 0x0000     # reset 0x8008
+    if [ ${#sample} -gt 6 ]; then
+      h $((sample >> 16)) $((sample & 0xffff))
+    else
+      h $((sample))
+    fi
+    h 0x2000            # movs r0, #0
+    h 0xbf10            # yield
+  } > "$img"
+
+  if ! $sim --counters "$counters" "$img" > /dev/null ||
+     [ "$(count "$winner")" != 1 ] || [ "$(count "$loser")" != 0 ]; then
+    echo "decode-overlaps: $sample is not decoded as $winner"
+    exit 1
+  fi
+done
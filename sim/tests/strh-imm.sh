@@ -0,0 +1,43 @@
+#!/bin/sh
+# strh with a non-zero immediate offset, read back through ldrb and ldrh.
+# The loop runs past the jit threshold so --jit runs it translated too.
+# usage: strh-imm.sh <sim>
+
+sim=${1:-build/sim}
+img=$(mktemp)
+trap 'rm -f "$img"' EXIT
+
+# little-endian halfwords
+h() {
+  for x; do
+    printf "\\$(printf %03o $((x & 0xff)))\\$(printf %03o $((x >> 8)))"
+  done
+}
+
+{
+  h 0x1000 0x2000     # msp 0x20001000
+  h 0x8009 0x0000     # reset 0x8008
+  h 0x2520            # movs r5, #32
+  h 0x2101            # movs r1, #1
+  h 0x0208            # lsls r0, r1, #8
+  h 0x2700            # movs r7, #0
+  h 0x1c2e            # loop: adds r6, r5, #0
+  h 0x8146            # strh r6, [r0, #10]
+  h 0x7a83            # ldrb r3, [r0, #10]
+  h 0x8944            # ldrh r4, [r0, #10]
+  h 0x4073            # eors r3, r6
+  h 0x4074            # eors r4, r6
+  h 0x431f            # orrs r7, r3
+  h 0x4327            # orrs r7, r4
+  h 0x3d01            # subs r5, #1
+  h 0xd1f5            # bne loop
+  h 0x1c38            # adds r0, r7, #0
+  h 0xbf10            # yield
+} > "$img"
+
+for mode in "" --jit; do
+  if ! $sim $mode "$img" > /dev/null; then
+    echo "strh-imm: failed ${mode:-without --jit}"
+    exit 1
+  fi
+done